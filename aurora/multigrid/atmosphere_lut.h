@@ -0,0 +1,81 @@
+/**
+  Precomputed atmosphere optical depth lookup table.
+
+  Each texel stores ln(optical depth) from a point at some altitude,
+  looking along some view direction, out to space.  The optical depth
+  of any ray span is then a difference of two lookups (see
+  atmosphere_thickness_lut in raytrace.txt).
+
+  Table x: altitude, from 0 at the surface to air_top at the top.
+  Table y: sqrt of the view direction's fraction of the way from the
+  horizon (cos(zenith)==mu_horizon) to straight up (cos(zenith)==1),
+  which puts most of the rows near the horizon, where depth changes fast.
+
+  The atmosphere model must match atmosphere_thickness() in raytrace.txt.
+  (Public Domain)
+*/
+#ifndef __AURORA_ATMOSPHERE_LUT_H
+#define __AURORA_ATMOSPHERE_LUT_H
+
+#include <vector>
+#include <cmath>
+
+enum {air_lut_size=256}; // table is air_lut_size x air_lut_size texels
+const double air_top=75.0*km; // altitude of top of table (and of atmosphere shell)
+const double air_scaleheight=8.0*km; // atmosphere density falls by 1/e over this height
+const double air_refDen=100.0; // atmosphere opacity per planetary radius at the surface
+
+/* Return the optical depth from radius r, looking along cos(zenith)==mu, out to space.
+   Integrated numerically, with Simpson's rule. */
+double air_optical_depth(double r,double mu)
+{
+	double space=1.0+2.0*air_top; // density here is exp(-18): negligible
+	// Ray t where we leave the sphere of radius space (ray is r*up + t*dir)
+	double b=r*mu, c=r*r-space*space;
+	double tmax=-b+sqrt(b*b-c);
+
+	const int n=512; // steps (even)
+	double h=tmax/n, sum=0.0;
+	for (int i=0;i<=n;i++) {
+		double t=i*h;
+		double rad=sqrt(r*r+2.0*t*r*mu+t*t); // radius at t
+		double den=exp(-(rad-1.0)/air_scaleheight);
+		double w=(i==0 || i==n)?1.0:((i&1)?4.0:2.0);
+		sum+=w*den;
+	}
+	return air_refDen*sum*h/3.0;
+}
+
+/* Return cos(zenith) of the horizon, seen from radius r */
+inline double air_mu_horizon(double r) {
+	return -sqrt(std::max(0.0,1.0-1.0/(r*r)));
+}
+
+/* Build the lookup table texture, and leave it bound to GL_TEXTURE_2D. */
+GLuint make_atmosphere_lut(void)
+{
+	printf("Building atmosphere table"); fflush(stdout);
+	std::vector<float> lut(air_lut_size*air_lut_size);
+	for (int y=0;y<air_lut_size;y++)
+	for (int x=0;x<air_lut_size;x++) {
+		double r=1.0+air_top*x/(air_lut_size-1.0);
+		double u=y/(air_lut_size-1.0);
+		double mu_h=air_mu_horizon(r);
+		double mu=mu_h+u*u*(1.0-mu_h);
+		lut[x+y*air_lut_size]=log(air_optical_depth(r,mu));
+	}
+	printf(".\n");
+
+	GLuint tex;
+	glGenTextures(1,&tex);
+	glBindTexture(GL_TEXTURE_2D,tex);
+	glTexImage2D(GL_TEXTURE_2D,0,GL_LUMINANCE32F_ARB,air_lut_size,air_lut_size,0,
+		GL_LUMINANCE,GL_FLOAT,&lut[0]);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+	return tex;
+}
+
+#endif
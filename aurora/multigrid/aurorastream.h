@@ -0,0 +1,242 @@
+/**
+  Animated aurora curtains, streamed from a numbered image sequence.
+
+  Frame k of the sequence belongs at time k*interval seconds, and the
+  shader blends the two frames either side of time_uniform.  Worker
+  threads decode a few frames ahead of playback (or load them from
+  the .dds cache, see texcache.h), and the render thread uploads them
+  a few megabytes per frame through a pair of alternating pixel buffer
+  objects.  Frames are only shown once they're completely uploaded;
+  if playback gets ahead of loading, we keep showing the newest frames
+  we have instead of stalling.  A frame that fails to load is skipped:
+  we show its neighbor instead.  The sequence loops.
+
+  Each frame also builds its own macrocell pyramid (see macrocell.h)
+  on the worker thread, so when the frames shown change, the render
+  thread only takes the max of two pyramids and uploads it.
+  (Public Domain)
+*/
+#ifndef __AURORA_STREAM_H
+#define __AURORA_STREAM_H
+
+#include <map>
+#include <deque>
+#include <vector>
+#include <string>
+#include "texloader.h"
+#include "macrocell.h"
+
+/** One frame of aurora curtains: green, compressed, with its macrocell pyramid. */
+class aurora_frame : public async_texture {
+public:
+	aurora_macrocell_levels cells; // valid once decoded()
+	aurora_frame(const std::string &file,const std::vector<float> &deposition_)
+		:async_texture(file,GL_COMPRESSED_RED_RGTC1,1), deposition(deposition_)
+	{
+		hook_texels=true;
+	}
+protected:
+	void decode_hook(const unsigned char *texels,int w,int h) {
+		std::vector<float> curtain;
+		aurora_curtain_cells(texels,w,0,0,w,h,w,h,curtain);
+		aurora_macrocell_pyramid(curtain,std::min(w,h),deposition,cells);
+	}
+private:
+	const std::vector<float> &deposition; // max deposition per altitude cell
+};
+
+/** Plays back a sequence of aurora curtain frames. */
+class aurora_stream {
+public:
+	int w,h; // size of the frames shown (0 until we show one)
+	GLuint tex0, tex1; // frames before and after the current time (0 until loaded)
+	float blend; // fraction of the way from tex0 to tex1
+
+	/* Play back files pattern (a printf format, like "tex/aurora_%04d.jpg"),
+	   one frame every interval seconds, decoding this many frames ahead.
+	   Macrocells use this deposition image. */
+	aurora_stream(const std::string &pattern_,double interval_,const char *depositionfile_,int ahead_=3)
+		:w(0), h(0), tex0(0), tex1(0), blend(0.0f), pattern(pattern_), depositionfile(depositionfile_),
+		 interval(interval_), ahead(ahead_), first(0), nframes(0), shown0(-1), shown1(-1), stopping(false)
+	{
+		pbo[0]=pbo[1]=0;
+		next_pbo=0;
+	}
+	/* Stop our worker threads, and free our frames */
+	~aurora_stream() {
+		{ porlock_scoped l(&lock); stopping=true; }
+		wake.broadcast();
+		for (unsigned int i=0;i<workers.size();i++) porthread_wait(workers[i]);
+		for (std::map<long,aurora_frame *>::iterator it=frames.begin();it!=frames.end();++it) {
+			glDeleteTextures(1,&it->second->tex);
+			delete it->second;
+		}
+		if (pbo[0]) glDeleteBuffersARB(2,pbo);
+	}
+
+	/* Find our frames, and start decoding with this many worker threads */
+	void start(int threads=2) {
+		for (first=0;first<=1;first++) if (frame_exists(first)) break;
+		if (frame_file(first)==frame_file(first+1)) nframes=frame_exists(first)?1:0; // not a pattern
+		else while (frame_exists(first+nframes)) nframes++;
+		if (nframes==0) {
+			printf("No aurora frames match '%s'\n",pattern.c_str());
+			exit(1);
+		}
+		printf("Streaming %d aurora frames from '%s'\n",nframes,pattern.c_str());
+		aurora_deposition_cells(depositionfile,deposition);
+		glGenBuffersARB(2,pbo);
+		for (int i=0;i<threads;i++) workers.push_back(porthread_create(worker,this));
+	}
+
+	/**
+	  Call once per frame, from the render thread: queue up the frames
+	  around this playback time, and upload up to budget bytes of them.
+	  Returns true if the frames shown changed (so the caller should
+	  upload new macrocells()).
+	*/
+	bool update(double time,size_t budget) {
+		long k0=(long)floor(time/interval); // frame just before time
+		load_frames(k0);
+
+		// Upload the frames we'll need soonest first
+		glActiveTexture(GL_TEXTURE0); // don't disturb the textures the shader uses
+		size_t sent=0;
+		for (std::map<long,aurora_frame *>::iterator it=frames.lower_bound(k0);
+			it!=frames.end() && sent<budget; ++it)
+		{
+			sent+=it->second->upload(budget-sent,pbo[next_pbo]);
+			next_pbo^=1; // the driver may still be reading the other one
+		}
+		glBindTexture(GL_TEXTURE_2D,0);
+
+		// Show the newest frames we have
+		long s0=shown0, s1=shown1, a, b;
+		if (choose(k0,a,b)) {
+			if (ready(a) && ready(b)) { s0=a; s1=b; }
+			else if (ready(a)) { s0=s1=a; }
+		}
+		blend=(s0==k0 && s1==k0+1)?(float)(time/interval-k0):0.0f;
+		if (s0==shown0 && s1==shown1) return false;
+		shown0=s0; shown1=s1;
+		tex0=frames[s0]->tex; tex1=frames[s1]->tex;
+		w=frames[s0]->w; h=frames[s0]->h;
+		return true;
+	}
+
+	/* Block until the frames for this playback time are shown (e.g., for benchmarking).
+	   Returns true if the frames shown changed. */
+	bool finish(double time) {
+		long k0=(long)floor(time/interval);
+		bool changed=false;
+		for (long a,b;;) {
+			if (!choose(k0,a,b)) {
+				printf("Aurora frames %ld and %ld both failed to load\n",k0,k0+1);
+				exit(1);
+			}
+			if (shown0==a && shown1==b) break;
+			changed=update(time,(size_t)-1) || changed;
+			porthread_yield(1);
+		}
+		return changed;
+	}
+
+	/* Upload the macrocell pyramid for both frames shown (into tex, if
+	   it's already a macrocell texture), and leave it bound to GL_TEXTURE_3D. */
+	GLuint macrocells(GLuint tex) {
+		const aurora_macrocell_levels &c0=frames[shown0]->cells, &c1=frames[shown1]->cells;
+		if (shown0==shown1) return upload_aurora_macrocells(c0,tex);
+		aurora_macrocell_levels both(c0); // emission can be as bright as either frame
+		for (unsigned int l=0;l<both.size();l++)
+		for (unsigned int i=0;i<both[l].size();i++) both[l][i]=std::max(both[l][i],c1[l][i]);
+		return upload_aurora_macrocells(both,tex);
+	}
+
+private:
+	std::string pattern;
+	const char *depositionfile;
+	std::vector<float> deposition; // max deposition per macrocell altitude
+	double interval; // seconds per frame
+	int ahead; // frames to load past the pair we show
+	int first, nframes; // file number of frame 0, and frames in the sequence
+	std::map<long,aurora_frame *> frames; // loading or loaded, by frame number
+	long shown0, shown1; // frame numbers shown (-1 if none)
+	GLuint pbo[2]; // pixel unpack buffers, used alternately
+	int next_pbo;
+
+	porlock lock; // protects queue and stopping
+	porcond wake; // signalled when queue grows, or we're stopping
+	std::deque<aurora_frame *> queue; // frames for workers to decode, soonest first
+	bool stopping; // workers should exit
+	std::vector<porthread_t> workers; // our worker threads
+
+	std::string frame_file(int i) const {
+		char name[1024];
+		snprintf(name,sizeof(name),pattern.c_str(),i);
+		return name;
+	}
+	bool frame_exists(int i) const {
+		struct stat s;
+		return stat(frame_file(i).c_str(),&s)==0;
+	}
+
+	/* Return true if frame k is uploaded and can be shown */
+	bool ready(long k) {
+		std::map<long,aurora_frame *>::iterator it=frames.find(k);
+		return it!=frames.end() && it->second->finished() && it->second->decoded();
+	}
+	/* Return true if frame k couldn't be loaded */
+	bool failed(long k) {
+		std::map<long,aurora_frame *>::iterator it=frames.find(k);
+		return it!=frames.end() && it->second->finished() && !it->second->decoded();
+	}
+	/* Pick frames a and b to show between frames k0 and k0+1, skipping
+	   a failed frame for its neighbor.  Returns false if both failed. */
+	bool choose(long k0,long &a,long &b) {
+		a=k0; b=k0+1;
+		if (failed(a)) a=b;
+		if (failed(b)) b=a;
+		return !failed(a);
+	}
+
+	/* Queue up frames k0 .. k0+1+ahead, and free frames we're done with */
+	void load_frames(long k0) {
+		porlock_scoped l(&lock);
+		for (long k=k0;k<=k0+1+ahead;k++) if (frames.find(k)==frames.end()) {
+			long i=((k%nframes)+nframes)%nframes; // the sequence loops
+			aurora_frame *f=new aurora_frame(frame_file(first+i),deposition);
+			frames[k]=f;
+			queue.push_back(f);
+			wake.signal();
+		}
+		for (std::map<long,aurora_frame *>::iterator it=frames.begin();it!=frames.end();) {
+			long k=it->first;
+			aurora_frame *f=it->second;
+			bool needed=(k>=k0 && k<=k0+1+ahead) || k==shown0 || k==shown1;
+			std::deque<aurora_frame *>::iterator q=std::find(queue.begin(),queue.end(),f);
+			bool decoding=(q==queue.end()) && !f->decoded() && !f->finished();
+			if (needed || decoding) { ++it; continue; } // a worker still has it
+			if (q!=queue.end()) queue.erase(q);
+			glDeleteTextures(1,&f->tex);
+			delete f;
+			frames.erase(it++);
+		}
+	}
+
+	/* Worker thread: decode queued frames, soonest first */
+	static void worker(void *arg) {
+		aurora_stream *s=(aurora_stream *)arg;
+		while (true) {
+			aurora_frame *f=NULL;
+			{
+				porlock_scoped l(&s->lock);
+				while (s->queue.empty() && !s->stopping) s->wake.wait(s->lock);
+				if (s->stopping) return;
+				f=s->queue.front(); s->queue.pop_front();
+			}
+			f->decode();
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,222 @@
+/**
+  Empty-space skipping volume for the aurora curtains.
+
+  Each macrocell stores the maximum aurora emission anywhere inside it,
+  over a 3D grid of polar stereographic map x, map y, and altitude.
+  The mip pyramid above it stores the max of its 2x2x2 children, so
+  the shader can skip whole empty regions in one step.
+
+  Emission is deposition(altitude) * curtain(map), as in sample_aurora
+  in raytrace.txt, so each cell's max is the max deposition over its
+  altitude span times the max curtain over its map area.  Both spans
+  are widened by one texel, to cover bilinear filtering, and the
+  curtain's by the footprint of the coarsest mip the shader samples
+  (macro_max_lod), since far away a blurry mip spreads curtain glow
+  into neighboring cells.  Cells are only zero when every sample
+  inside them is exactly zero.
+  (Public Domain)
+*/
+#ifndef __AURORA_MACROCELL_H
+#define __AURORA_MACROCELL_H
+
+#include <vector>
+#include <algorithm>
+
+enum {
+	macro_xy=1024, // macrocells across the polar stereo map
+	macro_z=8, // macrocells through the aurora's altitude
+	macro_levels=10, // coarsest mip level (1x1x1)
+	macro_max_lod=3 // coarsest curtain mip the shader samples: must match raytrace.txt
+};
+const double macro_lo=85.0*km, macro_hi=300.0*km; // altitude span of volume
+const double deposition_max_height=300.0*km; // altitude at top of deposition.bmp
+
+/* Return the range of texels [lo,hi] that bilinear filtering can touch,
+   for texture coordinates in [c0,c1] on a texture this many texels wide. */
+inline void macro_texel_range(double c0,double c1,int texels,int &lo,int &hi)
+{
+	lo=std::max(0,(int)floor(c0*texels-0.5));
+	hi=std::min(texels-1,(int)floor(c1*texels-0.5)+1);
+}
+
+/* Load this image's pixels with SOIL, or exit if it's missing. */
+unsigned char *macro_load_image(const char *filename,int &w,int &h,int &channels)
+{
+	unsigned char *img=SOIL_load_image(filename,&w,&h,&channels,0);
+	if (img==NULL) {
+		printf("Error reading '%s' for aurora macrocells: %s\n",filename,SOIL_last_result());
+		exit(1);
+	}
+	return img;
+}
+
+/* Raise the max curtain brightness of each map cell this block of
+   texels overlaps.  texels[x+y*pitch] is texel (x0+x,y0+y) of a w x h
+   texture, for x<tw and y<th.  Start with an empty curtain. */
+void aurora_curtain_cells(const unsigned char *texels,int pitch,int x0,int y0,int tw,int th,
+	int w,int h,std::vector<float> &curtain)
+{
+	if (curtain.empty()) curtain.resize(macro_xy*macro_xy,0.0f);
+	// Cells whose bilinear texel range can include our block
+	int cx0=std::max(0,(int)floor((x0-0.5)*macro_xy/w)-1), cx1=std::min(macro_xy-1,(int)floor((x0+tw+0.5)*macro_xy/w));
+	int cy0=std::max(0,(int)floor((y0-0.5)*macro_xy/h)-1), cy1=std::min(macro_xy-1,(int)floor((y0+th+0.5)*macro_xy/h));
+	for (int cy=cy0;cy<=cy1;cy++)
+	for (int cx=cx0;cx<=cx1;cx++) {
+		int tx0,tx1,ty0,ty1;
+		macro_texel_range(cx/(double)macro_xy,(cx+1)/(double)macro_xy,w,tx0,tx1);
+		macro_texel_range(cy/(double)macro_xy,(cy+1)/(double)macro_xy,h,ty0,ty1);
+		tx0=std::max(tx0,x0); tx1=std::min(tx1,x0+tw-1); // just the part in our block
+		ty0=std::max(ty0,y0); ty1=std::min(ty1,y0+th-1);
+		int m=0;
+		for (int y=ty0;y<=ty1;y++)
+		for (int x=tx0;x<=tx1;x++) m=std::max(m,(int)texels[(x-x0)+(y-y0)*pitch]);
+		float &c=curtain[cx+cy*macro_xy];
+		c=std::max(c,m*(1.0f/255));
+	}
+}
+
+/* Widen each curtain cell's max over the cells a macro_max_lod mip texel
+   can reach, for a curtain texture this many texels across. */
+void aurora_curtain_dilate(std::vector<float> &curtain,int texels)
+{
+	int r=(int)ceil((1<<macro_max_lod)*macro_xy/(double)texels); // in cells
+	std::vector<float> row(curtain.size());
+	for (int y=0;y<macro_xy;y++) // separable max: along x into row...
+	for (int x=0;x<macro_xy;x++) {
+		float m=0.0f;
+		for (int i=std::max(0,x-r);i<=std::min(macro_xy-1,x+r);i++) m=std::max(m,curtain[i+y*macro_xy]);
+		row[x+y*macro_xy]=m;
+	}
+	for (int y=0;y<macro_xy;y++) // ...then along y back into curtain
+	for (int x=0;x<macro_xy;x++) {
+		float m=0.0f;
+		for (int i=std::max(0,y-r);i<=std::min(macro_xy-1,y+r);i++) m=std::max(m,row[x+i*macro_xy]);
+		curtain[x+y*macro_xy]=m;
+	}
+}
+
+/** The aurora curtain virtual texture, which also finds its macrocell curtain
+    maxima from its level 0 tiles, on the worker thread, as the tiles are opened.
+    The shader only reads green, so that's all we keep, compressed. */
+class aurora_curtain_vt : public virtual_texture {
+public:
+	std::vector<float> curtain; // valid once decoded()
+	aurora_curtain_vt(const char *file) :virtual_texture(file,1) {
+		hook_tiles=true;
+	}
+protected:
+	void tile_hook(const unsigned char *texels,int pitch,int x0,int y0,int tw,int th) {
+		aurora_curtain_cells(texels,pitch,x0,y0,tw,th,w,h,curtain);
+	}
+};
+
+/* Find the max deposition (squared, like the shader) over each altitude cell */
+void aurora_deposition_cells(const char *depositionfile,std::vector<float> &deposition)
+{
+	int w,h,c;
+	unsigned char *img=macro_load_image(depositionfile,w,h,c);
+	deposition.resize(macro_z);
+	int u0,u1;
+	macro_texel_range(0.4,0.4,w,u0,u1); // shader samples column 0.4
+	for (int cz=0;cz<macro_z;cz++) {
+		double alt0=macro_lo+(macro_hi-macro_lo)*cz/macro_z;
+		double alt1=macro_lo+(macro_hi-macro_lo)*(cz+1)/macro_z;
+		int v0,v1; // shader's v is 1-altitude/max, which is image row altitude/max
+		macro_texel_range(alt0/deposition_max_height,alt1/deposition_max_height,h,v0,v1);
+		int m=0;
+		for (int y=v0;y<=v1;y++)
+		for (int x=u0;x<=u1;x++)
+		for (int i=0;i<std::min(c,3);i++) m=std::max(m,(int)img[(y*w+x)*c+i]);
+		deposition[cz]=(m*(1.0/255))*(m*(1.0/255));
+	}
+	SOIL_free_image_data(img);
+}
+
+/** The macrocell pyramid's texels: levels[0] is the finest. */
+typedef std::vector< std::vector<unsigned char> > aurora_macrocell_levels;
+
+/* Build the macrocell pyramid from these curtain cells, for a curtain
+   texture this many texels across, and deposition cells.  Returns the
+   fraction of finest-level cells that are empty.  No OpenGL, so this can
+   run on a worker thread. */
+double aurora_macrocell_pyramid(std::vector<float> curtain,int texels,const std::vector<float> &deposition,
+	aurora_macrocell_levels &levels)
+{
+	levels.resize(macro_levels+1);
+	aurora_curtain_dilate(curtain,texels);
+
+// Finest level: product, rounded up so any emission at all is nonzero
+	std::vector<unsigned char> &cells=levels[0];
+	cells.resize(macro_xy*macro_xy*macro_z);
+	int empty=0;
+	for (int cz=0;cz<macro_z;cz++)
+	for (int cxy=0;cxy<macro_xy*macro_xy;cxy++) {
+		float e=deposition[cz]*curtain[cxy];
+		unsigned char &m=cells[cxy+cz*macro_xy*macro_xy];
+		m=(unsigned char)std::min(255.0f,ceil(e*255.0f));
+		if (m==0) empty++;
+	}
+
+// Coarser levels: max-reduce 2x2x2 blocks
+	int nxy=macro_xy, nz=macro_z;
+	for (int level=1;level<=macro_levels;level++) {
+		int pxy=std::max(1,nxy/2), pz=std::max(1,nz/2);
+		const std::vector<unsigned char> &child=levels[level-1];
+		std::vector<unsigned char> &parent=levels[level];
+		parent.assign(pxy*pxy*pz,0);
+		for (int z=0;z<nz;z++)
+		for (int y=0;y<nxy;y++)
+		for (int x=0;x<nxy;x++) {
+			unsigned char &p=parent[x/2+(y/2)*pxy+(z*pz/nz)*pxy*pxy];
+			p=std::max(p,child[x+y*nxy+z*nxy*nxy]);
+		}
+		nxy=pxy; nz=pz;
+	}
+	return empty/(double)cells.size();
+}
+
+/* Upload this macrocell pyramid (into tex, if it's already a macrocell
+   texture), and leave it bound to GL_TEXTURE_3D. */
+GLuint upload_aurora_macrocells(const aurora_macrocell_levels &levels,GLuint tex=0)
+{
+	if (tex==0) {
+		glGenTextures(1,&tex);
+		glBindTexture(GL_TEXTURE_3D,tex);
+		glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_MIN_FILTER,GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_R,GL_CLAMP_TO_EDGE);
+		int nxy=macro_xy, nz=macro_z;
+		for (int level=0;level<=macro_levels;level++) {
+			glTexImage3D(GL_TEXTURE_3D,level,GL_LUMINANCE8,nxy,nxy,nz,0,
+				GL_LUMINANCE,GL_UNSIGNED_BYTE,NULL);
+			nxy=std::max(1,nxy/2); nz=std::max(1,nz/2);
+		}
+	}
+	glBindTexture(GL_TEXTURE_3D,tex);
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	int nxy=macro_xy, nz=macro_z;
+	for (int level=0;level<=macro_levels;level++) {
+		glTexSubImage3D(GL_TEXTURE_3D,level,0,0,0,nxy,nxy,nz,
+			GL_LUMINANCE,GL_UNSIGNED_BYTE,&levels[level][0]);
+		nxy=std::max(1,nxy/2); nz=std::max(1,nz/2);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT,4);
+	return tex;
+}
+
+/* Build the macrocell pyramid from these curtain cells, for a curtain
+   texture this many texels across, and leave it bound to GL_TEXTURE_3D. */
+GLuint make_aurora_macrocells(const std::vector<float> &curtain,int texels,const char *depositionfile)
+{
+	printf("Building aurora macrocells"); fflush(stdout);
+	std::vector<float> deposition;
+	aurora_deposition_cells(depositionfile,deposition);
+	aurora_macrocell_levels levels;
+	double empty=aurora_macrocell_pyramid(curtain,texels,deposition,levels);
+	printf(" (%.1f%% empty).\n",empty*100.0);
+	return upload_aurora_macrocells(levels);
+}
+
+#endif
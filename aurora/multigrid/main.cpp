@@ -8,6 +8,7 @@
 #include <GL/glew.h> /* 
 OpenGL Extensions Wrangler:  for gl...ARB extentions.  Must call glewInit after glutCreateWindow! */
 #include <GL/glut.h> /* OpenGL Utilities Toolkit, for GUI tools */
+#include "ogl/headless.h" /* -headless: render offscreen with EGL */
 #include "ogl/glsl.h"
 #include "ogl/glsl.cpp"
 #define USE_OGL_JOYSTICK 1 /* joystick makes for very smooth camera motion */
@@ -18,48 +19,37 @@ OpenGL Extensions Wrangler:  for gl...ARB extentions.  Must call glewInit after
 #include "ogl/pixelbench.h"
 
 const float km=1.0/6371.0; // convert kilometers to render units (planet radii)
+const float fovy=70.0; // vertical field of view, degrees
 int benchmode=0;
+const char *streampattern=NULL; // animated aurora frames (-stream), or NULL for static curtains
+double streaminterval=1.0; // seconds per animation frame
 double threshold=0.1; // total color error to allow before subdividing
+double costweight=0.0; // how much ray march cost scales threshold (0: not at all; see multigrid.h)
+double periphery=1.0; // threshold scale away from the gaze point (1: no foveation)
+double fovea_radius=0.2, fovea_falloff=0.3; // in image heights (see multigrid_foveation)
+const char *gazefile=NULL; // eye-tracker stand-in, "x y" re-read every frame (-gaze file), or NULL
+bool gazemouse=false; // gaze follows the mouse pointer (-gaze mouse)
+float gaze_x=0.5, gaze_y=0.5; // texture coordinates the viewer is looking at
+const char *thresholdmapfile=NULL; // image whose red scales threshold, like a HUD mask (-thresholdmap)
+double stereo_km=0.0; // distance between the eyes for side by side stereo (0: mono).  Aurora needs hyperstereo to show depth.
+int stereo_shared=1; // coarse multigrid levels both eyes share (see multigrid_renderer::render_views)
+double deadline=0.0; // milliseconds the multigrid levels may take, interpolating the rest (-deadline; 0: no limit)
+bool progressive=false; // refine the image while the camera holds still, then stop drawing (-progressive)
 
 /** SOIL **/
 #include "soil/SOIL.h" /* Simple OpenGL Image Library, www.lonesock.net/soil.html (plus Dr. Lawlor
 's modifications) */
 #include "soil/SOIL.c" /* just slap in implementation files here, for easier linking */
 #include "soil/stb_image_aug.c"
-void read_soil_jpeg(const char *filename, GLenum mode=GL_RGBA8)
-{
-	printf("Reading texture '%s'",filename); fflush(stdout);
-	GLuint srcTex = SOIL_load_OGL_texture
-	(
-		filename,
-		SOIL_LOAD_AUTO,
-		SOIL_CREATE_NEW_ID,
-		SOIL_FLAG_MIPMAPS | SOIL_FLAG_INVERT_Y,
-		mode
-	);
-	printf(".\n");
-	glBindTexture(GL_TEXTURE_2D,srcTex);
-}
-
-/* Load an OpenGL Cubemap texture from this directory (using SOIL) */
-unsigned int loadCubemap(const std::string &dir) {
-	return SOIL_load_OGL_cubemap(
-		(dir+"/Xp.jpg").c_str(),
-		(dir+"/Xm.jpg").c_str(),
-		(dir+"/Yp.jpg").c_str(),
-		(dir+"/Ym.jpg").c_str(),
-		(dir+"/Zp.jpg").c_str(),
-		(dir+"/Zm.jpg").c_str(),
-		0, // force channels
-		0, // make new texture ID
-		SOIL_FLAG_MIPMAPS
-	);
-}
-
 
 #include <vector>
 
 #include "multigrid.h" /* multigrid renderer */
+#include "atmosphere_lut.h" /* atmosphere optical depth table */
+#include "texloader.h" /* background texture loading */
+#include "virtualtex.h" /* aurora tiles paged on demand */
+#include "macrocell.h" /* aurora empty-space skipping */
+#include "aurorastream.h" /* animated aurora frames */
 class sphereProxy : public multigrid_proxy {
 public:
 	void draw() {
@@ -70,8 +60,45 @@ public:
 };
 
 
+/* Side by side stereo eyes, offset from the camera along its x axis */
+class stereoEyes : public multigrid_views {
+public:
+	float proj[16]; // cyclopean projection (and camera) matrix
+	vec3 offset; // from the camera to the right eye
+	stereoEyes(vec3 offset_) :multigrid_views(2), offset(offset_) {
+		glGetFloatv(GL_PROJECTION_MATRIX,proj);
+	}
+	~stereoEyes() { // leave the cyclopean camera for everybody else
+		glMatrixMode(GL_PROJECTION);
+		glLoadMatrixf(proj);
+		glMatrixMode(GL_MODELVIEW);
+	}
+	void set(GLhandleARB prog,int v) {
+		vec3 eye=camera+offset*(v==-1?0.0f:(v==0?-1.0f:+1.0f));
+		glMatrixMode(GL_PROJECTION);
+		glLoadMatrixf(proj);
+		glTranslatef(camera.x-eye.x,camera.y-eye.y,camera.z-eye.z); // world moves opposite the eye
+		glMatrixMode(GL_MODELVIEW);
+		glFastUniform3fv(prog,"C",1,eye);
+	}
+};
+
+/* Once a progressive image is finished, nothing asks for frames: so every
+   so often call display anyway, letting it notice a changed view (joystick,
+   released keys, new threshold or gaze) and start refining again.  If the
+   view hasn't changed, the screen already shows the image: display skips
+   drawing and swapping, and just polls again. */
+bool view_polling=false; // poll_view is waiting to fire
+bool view_polled=false; // this display is just poll_view checking
+void poll_view(int value) {
+	view_polling=false;
+	view_polled=true;
+	glutPostRedisplay();
+}
+
 void display(void) 
 {
+	bool polled=view_polled; view_polled=false;
 	glDisable(GL_DEPTH_TEST);
 	glDisable(GL_BLEND);
 	
@@ -85,8 +112,8 @@ void display(void)
 	
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity(); // flush any ancient matrices
-	gluPerspective(70.0, // fov
-		glutGet(GLUT_WINDOW_WIDTH)/(float)glutGet(GLUT_WINDOW_HEIGHT),
+	gluPerspective(fovy, // fov
+		glutGet(GLUT_WINDOW_WIDTH)/(stereo_km>0.0?2.0f:1.0f)/glutGet(GLUT_WINDOW_HEIGHT), // each eye's aspect
 		0.1,
 		1000.0); // z clipping planes
 	float altitude=length(camera);
@@ -104,26 +131,78 @@ void display(void)
 	glUseProgramObjectARB(prog);
 	glFastUniform3fv(prog,"C",1,camera);
 	
-	static bool read_imgs=true; /* only read textures on the first frame */
+	static bool read_imgs=true; /* only start reading textures on the first frame */
+	static async_texture_loader loader;
+	static async_texture *nightearth, *auroradistance, *deposition, *stars;
+	static aurora_curtain_vt *aurora=NULL; // static curtains...
+	static aurora_stream *stream=NULL; // ...or animated ones
+	if (read_imgs) {
+		nightearth=loader.add(new async_texture("tex/nightearth.png",GL_COMPRESSED_RED_RGTC1));
+		if (streampattern) {
+			stream=new aurora_stream(streampattern,streaminterval,"tex/deposition.bmp");
+			stream->start();
+		} else {
+			aurora=new aurora_curtain_vt("tex/aurora.jpg");
+			aurora->start();
+		}
+		auroradistance=loader.add(new async_texture("tex/aurora_distance.jpg",GL_LUMINANCE8));
+		deposition=loader.add(new async_texture("tex/deposition.bmp",GL_RGBA8));
+		stars=loader.add(new async_texture("tex/stars"));
+		loader.start();
+	}
+	bool loaded=true; // all the textures are up
+	if (benchmode) loader.finish(); // benchmarks need the real textures
+	else loaded=loader.update(4*1024*1024); // bytes per frame: a few milliseconds of upload
+	bool newframes=false; // animation moved on to new frames
+	if (stream) newframes=benchmode?stream->finish(start_time):stream->update(start_time,4*1024*1024);
+	else aurora->update(); // page in the tiles last frame's feedback asked for
+	
 /* Upload planet texture, to texture unit 1 */
 	glActiveTexture(GL_TEXTURE1);
-	if (read_imgs) read_soil_jpeg("tex/nightearth.png",GL_LUMINANCE8);
+	glBindTexture(GL_TEXTURE_2D,nightearth->tex);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAX_ANISOTROPY_EXT,4);
 	//glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
 	glFastUniform1i(prog,"nightearthtex",1); // texture unit number
 	
-/* Upload aurora source texture, to texture unit 2 */
-	glActiveTexture(GL_TEXTURE2);
-	if (read_imgs) read_soil_jpeg("tex/aurora.jpg",GL_RGBA8);
-	//glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAX_ANISOTROPY_EXT,4);
-	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+/* Upload aurora virtual texture tile atlas to texture unit 2, and indirection to unit 10 */
+	vec4 auroravt(1,1,1,0); // no tiles yet
+	if (aurora) {
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D,aurora->atlas);
+		glActiveTexture(GL_TEXTURE10);
+		glBindTexture(GL_TEXTURE_2D,aurora->indirect);
+		if (aurora->decoded()) auroravt=vec4(aurora->w,aurora->h,aurora->n0,aurora->top);
+		glFastUniform1f(prog,"auroravtslots",aurora->slots);
+	}
 	glFastUniform1i(prog,"auroratex",2); // texture unit number
+	glFastUniform1i(prog,"auroraindirect",10); // texture unit number
+	glFastUniform1f(prog,"vt_feedback",0.0);
+	
+/* Upload animated aurora frames, to texture units 11 and 12 */
+	if (stream) {
+		GLuint frames[2]={stream->tex0,stream->tex1}; // 0 until loaded: reads as black
+		for (int i=0;i<2;i++) {
+			glActiveTexture(GL_TEXTURE11+i);
+			glBindTexture(GL_TEXTURE_2D,frames[i]);
+			if (frames[i]==0) continue;
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR); // shader picks LOD
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+		}
+		auroravt=vec4(std::max(stream->w,1),std::max(stream->h,1),1,0);
+		glFastUniform1f(prog,"auroraframemix",stream->blend);
+	}
+	glFastUniform1i(prog,"auroraframe0",11); // texture unit number
+	glFastUniform1i(prog,"auroraframe1",12); // texture unit number
+	glFastUniform1f(prog,"aurorastream",stream?1.0:0.0);
+	glFastUniform4fv(prog,"auroravt",1,auroravt);
 	
 /* Upload aurora distance texture, to texture unit 3 */
 	glActiveTexture(GL_TEXTURE3);
-	if (read_imgs) read_soil_jpeg("tex/aurora_distance.jpg",GL_LUMINANCE8);
+	glBindTexture(GL_TEXTURE_2D,auroradistance->tex);
 	/* mipmaps screw up distance estimates at bottom of curtains. */
 	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
@@ -132,7 +211,7 @@ void display(void)
 	
 /* Upload deposition lookup texture, to texture unit 4 */
 	glActiveTexture(GL_TEXTURE4);
-	if (read_imgs) read_soil_jpeg("tex/deposition.bmp",GL_RGBA8);
+	glBindTexture(GL_TEXTURE_2D,deposition->tex);
 	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
@@ -140,9 +219,7 @@ void display(void)
 	
 /* Upload star cubemap, to texture unit 5 */
 	glActiveTexture(GL_TEXTURE5);
-	static unsigned int cubemap=0;
-	if (read_imgs) {cubemap=loadCubemap("tex/stars");}
-	glBindTexture(GL_TEXTURE_CUBE_MAP,cubemap);
+	glBindTexture(GL_TEXTURE_CUBE_MAP,stars->tex);
 	
 	glEnable(GL_TEXTURE_CUBE_MAP);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER,GL_LINEAR);
@@ -154,13 +231,28 @@ void display(void)
 	
 /* Upload cloud texture, to texture unit 6 
 	glActiveTexture(GL_TEXTURE6);
-	if (read_imgs) read_soil_jpeg("tex/clouds.jpg",GL_LUMINANCE8);
+	glBindTexture(GL_TEXTURE_2D,clouds->tex); // loader.add "tex/clouds.jpg" above
 	//glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAX_ANISOTROPY_EXT,8);
 	//glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_REPEAT);
 	glFastUniform1i(prog,"clouds",6); // texture unit number
 */
+
+/* Build atmosphere optical depth table, to texture unit 8 */
+	glActiveTexture(GL_TEXTURE8);
+	static GLuint airdepth=make_atmosphere_lut();
+	glBindTexture(GL_TEXTURE_2D,airdepth);
+	glFastUniform1i(prog,"airdepth",8); // texture unit number
+
+/* Build aurora macrocell pyramid, to texture unit 9 */
+	glActiveTexture(GL_TEXTURE9);
+	static GLuint macrocells=0; // stays empty (skip everything) until the curtains decode
+	if (macrocells==0 && aurora && aurora->decoded())
+		macrocells=make_aurora_macrocells(aurora->curtain,std::min(aurora->w,aurora->h),"tex/deposition.bmp");
+	if (newframes) macrocells=stream->macrocells(macrocells); // covers both animation frames we're showing
+	glBindTexture(GL_TEXTURE_3D,macrocells);
+	glFastUniform1i(prog,"auroramacro",9); // texture unit number
 	
 	
 	read_imgs=false;
@@ -176,15 +268,59 @@ void display(void)
 	
 	make_multigrid_renderer;
 	sphereProxy proxy;
-	renderer->render(prog,threshold,proxy);
+	renderer->fovy=fovy;
+	float footprint=renderer->pixel_footprint(renderer->fb[0]);
+	if (aurora) {
+		if (benchmode) aurora->finish(prog,proxy,mg_wid,mg_ht,footprint); // benchmarks need the real tiles
+		else aurora->feedback(prog,proxy,mg_wid,mg_ht,footprint); // which tiles does this view need?
+	}
+	renderer->costweight=costweight;
+	renderer->deadline=deadline;
+	if (gazefile) renderer->fovea.read_gaze(gazefile); // else keep the last one
+	else { renderer->fovea.x=gaze_x; renderer->fovea.y=gaze_y; }
+	renderer->fovea.radius=fovea_radius;
+	renderer->fovea.falloff=fovea_falloff;
+	renderer->fovea.periphery=periphery;
+	static GLuint thresholdmap=thresholdmapfile?SOIL_load_OGL_texture(thresholdmapfile,
+		SOIL_LOAD_AUTO,SOIL_CREATE_NEW_ID,SOIL_FLAG_INVERT_Y):0;
+	if (thresholdmapfile && !thresholdmap) { printf("Can't load threshold map '%s'\n",thresholdmapfile); exit(1); }
+	renderer->fovea.map=thresholdmap;
+	if (key_down['t']) { threshold*=2.0; key_down['t']=false; }
+	if (key_down['y']) { threshold*=0.5; key_down['y']=false; }
+	bool finished=false; // progressive image is done: no need to draw again
+	if (stereo_km>0.0) {
+		renderer->shared_levels=stereo_shared;
+		stereoEyes eyes(0.5f*stereo_km*km*camera_orient.x);
+		renderer->render_views(prog,threshold,proxy,eyes);
+	}
+	else if (progressive) {
+		// Start over if anything onscreen changed since last frame
+		static float last_view[16+3+3];
+		float view[16+3+3];
+		glGetFloatv(GL_PROJECTION_MATRIX,view);
+		for (int i=0;i<3;i++) view[16+i]=camera[i];
+		view[19]=threshold; view[20]=renderer->fovea.x; view[21]=renderer->fovea.y;
+		bool still=true; // (allowing for roundoff: minicam renormalizes the orientation every frame)
+		for (int i=0;i<16+3+3;i++) {
+			if (fabs(view[i]-last_view[i])>1.0e-5*(1.0+fabs(view[i]))) still=false;
+			last_view[i]=view[i];
+		}
+		bool settled=loaded && !stream && (!aurora || (aurora->decoded() && aurora->idle()));
+		if (!still || !settled) renderer->restart();
+		if (polled && renderer->converged()) { // nothing changed: leave the screen be
+			glUseProgramObjectARB(0);
+			view_polling=true;
+			glutTimerFunc(100,poll_view,0);
+			return;
+		}
+		finished=renderer->render_progressive(prog,threshold,proxy);
+	}
+	else renderer->render(prog,threshold,proxy);
 	
 	glUseProgramObjectARB(0);
 	
 	if (benchmode==2) {oglPixelBench(display,64,4); return;}
 	
-	if (key_down['t']) { threshold*=2.0; key_down['t']=false; }
-	if (key_down['y']) { threshold*=0.5; key_down['y']=false; }
-	
 	static int movie_mode=0;
 	static double last_movieframe=0.0;
 	static double frame_interval=1.0/24; /* time between movie frames, seconds */
@@ -214,7 +350,11 @@ void display(void)
 	double cur_time=0.001*glutGet(GLUT_ELAPSED_TIME);
 	
 	
-	glutPostRedisplay(); // continual animation
+	if (!finished || movie_mode) glutPostRedisplay(); // continual animation
+	else if (!view_polling) { // finished: the view check above restarts us, so keep looking
+		view_polling=true;
+		glutTimerFunc(100,poll_view,0);
+	}
 	glutSwapBuffers(); //<- waits for VSYNC?
 	
 	static double total_time=0.0;
@@ -245,10 +385,10 @@ void display(void)
 		}
 		else { /* not a benchmark, just an ordinary run */
 			char str[100];
-			sprintf(str,"Aurora Renderer: %.1f fps, %.1f ms/frame (%.1f km, threshold %.2f)",
+			sprintf(str,"Aurora Renderer: %.1f fps, %.1f ms/frame (%.1f km, threshold %.2f, cost weight %.2f, periphery %.1f)",
 				1.0/time_per_frame,1.0e3*time_per_frame,
 				(altitude-1.0)/km,
-				threshold);
+				threshold,costweight,periphery);
 #ifndef MPIGLUT_H
 			printf("%s\n",str);
 
@@ -264,6 +404,13 @@ void display(void)
 	}
 }
 
+/* Mouse moving with no buttons down: that's where we're looking (buttons steer the camera) */
+void gaze_motion(int x,int y) {
+	gaze_x=(x+0.5f)/glutGet(GLUT_WINDOW_WIDTH);
+	gaze_y=1.0f-(y+0.5f)/glutGet(GLUT_WINDOW_HEIGHT);
+	glutPostRedisplay(); // a finished progressive image needs redrawing
+}
+
 int main(int argc,char *argv[]) 
 {
 	glutInit(&argc,argv);
@@ -277,7 +424,26 @@ int main(int argc,char *argv[])
 	for (int argi=1;argi<argc;argi++) {
 		if (0==strcmp(argv[argi],"-bench")) benchmode=1;
 		else if (0==strcmp(argv[argi],"-threshold")) { threshold=atof(argv[++argi]); }
+		else if (0==strcmp(argv[argi],"-costweight")) { costweight=atof(argv[++argi]); }
+		else if (0==strcmp(argv[argi],"-periphery")) { periphery=atof(argv[++argi]); } // e.g., 10
+		else if (0==strcmp(argv[argi],"-fovea")) { // radius and falloff, e.g., -fovea 0.2 0.3
+			fovea_radius=atof(argv[++argi]);
+			fovea_falloff=atof(argv[++argi]);
+		}
+		else if (0==strcmp(argv[argi],"-gaze")) { // "mouse", or a file like gaze.txt
+			const char *g=argv[++argi];
+			if (0==strcmp(g,"mouse")) gazemouse=true; else gazefile=g;
+		}
+		else if (0==strcmp(argv[argi],"-thresholdmap")) { thresholdmapfile=argv[++argi]; }
+		else if (0==strcmp(argv[argi],"-stereo")) { stereo_km=atof(argv[++argi]); } // e.g., 1.0
+		else if (0==strcmp(argv[argi],"-stereoshared")) { stereo_shared=atoi(argv[++argi]); }
+		else if (0==strcmp(argv[argi],"-progressive")) progressive=true;
+		else if (0==strcmp(argv[argi],"-deadline")) { deadline=atof(argv[++argi]); } // e.g., 16
 		else if (0==strcmp(argv[argi],"-pixelbench")) benchmode=2;
+		else if (0==strcmp(argv[argi],"-stream")) { // e.g., -stream tex/aurora_%04d.jpg 2.0
+			streampattern=argv[++argi];
+			streaminterval=atof(argv[++argi]);
+		}
 		else if (2==sscanf(argv[argi],"%dx%d",&w,&h)) {}
 		else printf("Unrecognized argument '%s'!\n",argv[argi]);
 	}
@@ -290,6 +456,7 @@ int main(int argc,char *argv[])
 	
 	glutDisplayFunc(display);
 	oglCameraInit();
+	if (gazemouse) glutPassiveMotionFunc(gaze_motion);
 	//camera=vec3(0,-1.5,0.6); // over continental US
 	camera=vec3(-0.3,-0.8,1.1); // over Alaska
 	
@@ -0,0 +1,239 @@
+/**
+  Compressed texture disk cache.
+
+  Single-channel images are compressed to BC4 (GL_COMPRESSED_RED_RGTC1):
+  each 4x4 texel block stores its min and max exactly, plus a 3-bit
+  index per texel picking one of 8 evenly spaced values between them.
+  That's 4 bits per texel, against 8 for LUMINANCE8 or 32 for RGBA8.
+  Because the min and max survive exactly, zero texels stay zero, and
+  no texel gets brighter than its block's brightest source texel.
+
+  The compressed mip chain is saved as a .dds file next to its source
+  image.  Spare DDS header fields hold a hash of the source file's bytes,
+  its modification time, and the channel we compressed, so editing the
+  source (or compressing a different channel) rebuilds the cache.
+  Rows are stored bottom-up, in OpenGL order.
+  (Public Domain)
+*/
+#ifndef __AURORA_TEXCACHE_H
+#define __AURORA_TEXCACHE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+/** One mip level of one face: RGBA8 pixels, or BC4 blocks. */
+class texture_level {
+public:
+	int w,h;
+	std::vector<unsigned int> pixels;
+};
+
+/* Decode this image file's bytes to RGBA8 pixels, bottom row first if flip
+   (like SOIL_FLAG_INVERT_Y).  Returns false if it can't be decoded. */
+bool texture_decode(const std::string &name,const std::vector<unsigned char> &src,
+	bool flip,texture_level &out)
+{
+	int w,h,n;
+	unsigned char *data=stbi_load_from_memory(&src[0],src.size(),&w,&h,&n,4);
+	if (data==NULL) {
+		printf("Error loading texture '%s': %s\n",name.c_str(),stbi_failure_reason());
+		return false;
+	}
+	out.w=w; out.h=h; out.pixels.resize(w*h);
+	for (int y=0;y<h;y++)
+		memcpy(&out.pixels[y*w],&data[4*w*(flip?h-1-y:y)],4*w);
+	stbi_image_free(data);
+	return true;
+}
+
+/* Halve RGBA8 level 0 repeatedly (with fast_mipmaps.c), while both dimensions are at least 2 */
+void texture_build_mipmaps(std::vector<texture_level> &levels)
+{
+	while (levels.back().w>=2 && levels.back().h>=2) {
+		levels.push_back(texture_level());
+		const texture_level &src=levels[levels.size()-2];
+		texture_level &dst=levels.back();
+		dst.w=src.w/2; dst.h=src.h/2;
+		dst.pixels.resize(dst.w*dst.h);
+		for (int y=0;y<dst.h;y++)
+			oglBuildFastRow(dst.w,&src.pixels[src.w*(2*y+0)],&src.pixels[src.w*(2*y+1)],
+				&dst.pixels[dst.w*y]);
+	}
+}
+
+/* Bytes of BC4 blocks needed for a w x h image */
+inline int bc4_size(int w,int h) { return 8*((w+3)/4)*((h+3)/4); }
+
+/* Compress channel c (0=red, 1=green, ...) of these w x h RGBA8 pixels to BC4 */
+void bc4_compress(const unsigned char *rgba,int w,int h,int c,texture_level &out)
+{
+	out.w=w; out.h=h;
+	out.pixels.resize(bc4_size(w,h)/4);
+	unsigned char *dest=(unsigned char *)&out.pixels[0];
+	for (int by=0;by<h;by+=4)
+	for (int bx=0;bx<w;bx+=4) {
+		unsigned char v[16]; // block texels, clamped at the image edge
+		unsigned char lo=255, hi=0;
+		for (int i=0;i<16;i++) {
+			int x=std::min(w-1,bx+(i&3)), y=std::min(h-1,by+(i>>2));
+			v[i]=rgba[4*(x+y*w)+c];
+			lo=std::min(lo,v[i]); hi=std::max(hi,v[i]);
+		}
+		// 8-value mode: index 0 is hi, 1 is lo, 2..7 step from hi down to lo
+		unsigned long long bits=0;
+		if (hi>lo)
+		for (int i=0;i<16;i++) {
+			int p=((v[i]-lo)*14+(hi-lo))/(2*(hi-lo)); // nearest of 0(lo) .. 7(hi)
+			int index=(p==7)?0:((p==0)?1:8-p);
+			bits|=((unsigned long long)index)<<(3*i);
+		}
+		dest[0]=hi; dest[1]=lo;
+		for (int b=0;b<6;b++) dest[2+b]=(unsigned char)(bits>>(8*b));
+		dest+=8;
+	}
+}
+
+/* Replace these RGBA8 levels with BC4 blocks of this channel */
+void texture_compress_bc4(std::vector<texture_level> &levels,int c)
+{
+	for (unsigned int l=0;l<levels.size();l++) {
+		texture_level out;
+		bc4_compress((const unsigned char *)&levels[l].pixels[0],levels[l].w,levels[l].h,c,out);
+		levels[l].pixels.swap(out.pixels);
+	}
+}
+
+/* Decompress BC4 blocks to w x h 8-bit texels */
+void bc4_decompress(const texture_level &in,std::vector<unsigned char> &out)
+{
+	int w=in.w, h=in.h;
+	out.resize(w*h);
+	const unsigned char *src=(const unsigned char *)&in.pixels[0];
+	for (int by=0;by<h;by+=4)
+	for (int bx=0;bx<w;bx+=4) {
+		int hi=src[0], lo=src[1];
+		unsigned char value[8]={(unsigned char)hi,(unsigned char)lo};
+		for (int i=2;i<8;i++)
+			if (hi>lo) value[i]=((8-i)*hi+(i-1)*lo)/7;
+			else value[i]=(i<6)?((6-i)*hi+(i-1)*lo)/5:((i==6)?0:255);
+		unsigned long long bits=0;
+		for (int b=0;b<6;b++) bits|=((unsigned long long)src[2+b])<<(8*b);
+		for (int i=0;i<16;i++) {
+			int x=bx+(i&3), y=by+(i>>2);
+			if (x<w && y<h) out[x+y*w]=value[(bits>>(3*i))&7];
+		}
+		src+=8;
+	}
+}
+
+/* Read this whole file into memory.  Returns false if it can't be read. */
+bool texcache_read_file(const std::string &name,std::vector<unsigned char> &data)
+{
+	FILE *f=fopen(name.c_str(),"rb");
+	if (f==NULL) return false;
+	fseek(f,0,SEEK_END);
+	long len=ftell(f);
+	fseek(f,0,SEEK_SET);
+	data.resize(len);
+	bool ok=(len>0 && fread(&data[0],1,len,f)==(size_t)len);
+	fclose(f);
+	return ok;
+}
+
+/** Identifies the source of a cached texture. */
+class texcache_key {
+public:
+	unsigned int hash_lo, hash_hi; // 64-bit FNV-1a hash of source file bytes
+	unsigned int mtime; // source file modification time
+	unsigned int channel; // source channel we compressed
+
+	texcache_key(const std::string &source,const std::vector<unsigned char> &data,int channel_)
+		:mtime(0), channel(channel_)
+	{
+		unsigned long long h=14695981039346656037ull;
+		for (size_t i=0;i<data.size();i++) { h^=data[i]; h*=1099511628211ull; }
+		hash_lo=(unsigned int)h; hash_hi=(unsigned int)(h>>32);
+		struct stat s;
+		if (stat(source.c_str(),&s)==0) mtime=(unsigned int)s.st_mtime;
+	}
+	bool operator==(const texcache_key &k) const {
+		return hash_lo==k.hash_lo && hash_hi==k.hash_hi && mtime==k.mtime && channel==k.channel;
+	}
+};
+
+/* DDS file layout, as 32-bit words after the "DDS " magic number */
+enum {
+	dds_magic=0x20534444, // "DDS "
+	dds_fourcc_ati1=0x31495441, // "ATI1": BC4 unsigned
+	dds_size=0, dds_flags=1, dds_height=2, dds_width=3, dds_linearsize=4,
+	dds_mipcount=6, dds_reserved=7, // 11 spare words: we keep our key here
+	dds_pf_size=18, dds_pf_flags=19, dds_pf_fourcc=20,
+	dds_caps=26,
+	dds_words=31
+};
+
+/* Write these BC4 mip levels to this cache file. */
+void texcache_save(const std::string &cachefile,const texcache_key &key,
+	const std::vector<texture_level> &levels)
+{
+	unsigned int head[1+dds_words]={dds_magic};
+	unsigned int *d=head+1;
+	d[dds_size]=4*dds_words;
+	d[dds_flags]=0x1|0x2|0x4|0x1000|0x20000|0x80000; // caps, height, width, pixelformat, mipcount, linearsize
+	d[dds_height]=levels[0].h; d[dds_width]=levels[0].w;
+	d[dds_linearsize]=bc4_size(levels[0].w,levels[0].h);
+	d[dds_mipcount]=levels.size();
+	d[dds_reserved+0]=key.hash_lo; d[dds_reserved+1]=key.hash_hi;
+	d[dds_reserved+2]=key.mtime; d[dds_reserved+3]=key.channel;
+	d[dds_pf_size]=32; d[dds_pf_flags]=0x4; d[dds_pf_fourcc]=dds_fourcc_ati1; // fourcc
+	d[dds_caps]=0x1000|0x8|0x400000; // texture, complex, mipmap
+
+	std::string tmp=cachefile+".tmp"; // rename when complete, so we never leave half a file
+	FILE *f=fopen(tmp.c_str(),"wb");
+	if (f==NULL) { printf("Can't write texture cache '%s'\n",tmp.c_str()); return; }
+	bool ok=fwrite(head,sizeof(head),1,f)==1;
+	for (unsigned int l=0;l<levels.size();l++)
+		ok=ok && fwrite(&levels[l].pixels[0],bc4_size(levels[l].w,levels[l].h),1,f)==1;
+	if (fclose(f)!=0) ok=false;
+	if (!ok || rename(tmp.c_str(),cachefile.c_str())!=0) {
+		printf("Error writing texture cache '%s'\n",cachefile.c_str());
+		remove(tmp.c_str());
+	}
+}
+
+/* Read BC4 mip levels from this cache file.  Returns false if it's
+   missing, or wasn't made from this key's source. */
+bool texcache_load(const std::string &cachefile,const texcache_key &key,
+	std::vector<texture_level> &levels)
+{
+	std::vector<unsigned char> data;
+	if (!texcache_read_file(cachefile,data)) return false;
+	if (data.size()<4*(1+dds_words)) return false;
+	const unsigned int *head=(const unsigned int *)&data[0];
+	const unsigned int *d=head+1;
+	if (head[0]!=dds_magic || d[dds_size]!=4*dds_words || d[dds_pf_fourcc]!=dds_fourcc_ati1) return false;
+	texcache_key k=key;
+	k.hash_lo=d[dds_reserved+0]; k.hash_hi=d[dds_reserved+1];
+	k.mtime=d[dds_reserved+2]; k.channel=d[dds_reserved+3];
+	if (!(k==key)) return false; // stale
+
+	size_t offset=4*(1+dds_words);
+	int w=d[dds_width], h=d[dds_height];
+	levels.resize(d[dds_mipcount]);
+	for (unsigned int l=0;l<levels.size();l++) {
+		size_t bytes=bc4_size(w,h);
+		if (w<1 || h<1 || offset+bytes>data.size()) return false; // truncated
+		levels[l].w=w; levels[l].h=h;
+		levels[l].pixels.resize(bytes/4);
+		memcpy(&levels[l].pixels[0],&data[offset],bytes);
+		offset+=bytes;
+		w/=2; h/=2;
+	}
+	return true;
+}
+
+#endif
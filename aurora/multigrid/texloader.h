@@ -0,0 +1,287 @@
+/**
+  Background texture loading, with progressive upload.
+
+  Worker threads decode each image with stb_image and build its mip
+  levels with fast_mipmaps.c, while the render thread keeps drawing
+  with a black 1x1 placeholder.  Once an image is decoded, update()
+  streams it to OpenGL a few rows at a time through a pixel buffer
+  object.  2D textures upload their coarsest mip level first, and
+  sharpen over several frames; cubemaps appear once all six faces
+  are uploaded.
+
+  2D textures can also be stored as compressed GL_COMPRESSED_RED_RGTC1
+  (see texcache.h), which is cached on disk after the first run.
+  (Public Domain)
+*/
+#ifndef __AURORA_TEXLOADER_H
+#define __AURORA_TEXLOADER_H
+
+#include <vector>
+#include <string>
+#include <string.h>
+#include "osl/porthread.h"
+#include "osl/porthread.cpp"
+#include "texcache.h"
+
+/** One texture, loading in the background. */
+class async_texture {
+public:
+	GLuint tex; // OpenGL texture: a placeholder until we're loaded
+	int w,h; // size of level 0 (0 until decoded)
+
+	/* Start loading this 2D image.  Rows are flipped, like SOIL_FLAG_INVERT_Y.
+	   For format GL_COMPRESSED_RED_RGTC1, we compress this source channel
+	   (0=red, 1=green, ...), and the shader sees it in red, green, and blue,
+	   like a luminance texture. */
+	async_texture(const std::string &file,GLenum format_,int channel_=0)
+		:tex(0), w(0), h(0), hook_texels(false), target(GL_TEXTURE_2D), format(format_),
+		 channel(channel_), flip(true), mipmaps(true), state(state_queued)
+	{
+		files.push_back(file);
+		make_placeholder();
+	}
+
+	/* Start loading a cubemap from this directory's Xp.jpg, Xm.jpg, ... Zm.jpg */
+	async_texture(const std::string &dir)
+		:tex(0), w(0), h(0), hook_texels(false), target(GL_TEXTURE_CUBE_MAP), format(GL_RGBA8),
+		 channel(0), flip(false), mipmaps(false), state(state_queued)
+	{
+		const char *faces[6]={"Xp","Xm","Yp","Ym","Zp","Zm"};
+		for (int f=0;f<6;f++) files.push_back(dir+"/"+faces[f]+".jpg");
+		make_placeholder();
+	}
+	virtual ~async_texture() {}
+
+	/* Return true once the worker has decoded our pixels (w and h are then valid). */
+	bool decoded(void) { porlock_scoped l(&lock); return state>=state_decoded && state!=state_failed; }
+	/* Return true once we're fully uploaded (or failed to load). */
+	bool finished(void) { porlock_scoped l(&lock); return state>=state_done; }
+
+	/* Called by a worker thread: decode our images, and build mipmaps
+	   (or load them from the compressed texture cache). */
+	void decode(void) {
+		int w=0,h=0; // shadows our members until we're done
+		for (unsigned int f=0;f<files.size();f++) {
+			std::vector<unsigned char> src;
+			if (!texcache_read_file(files[f],src)) {
+				printf("Error loading texture '%s': can't read file\n",files[f].c_str());
+				porlock_scoped l(&lock); state=state_failed; return;
+			}
+			faces.push_back(std::vector<level_t>());
+			std::vector<level_t> &levels=faces.back();
+			texcache_key key(files[f],src,channel);
+			std::string cachefile=files[f]+".dds";
+			if (compressed() && texcache_load(cachefile,key,levels)) {
+				w=levels[0].w; h=levels[0].h;
+				continue;
+			}
+
+			levels.resize(1);
+			if (!texture_decode(files[f],src,flip,levels[0])) {
+				porlock_scoped l(&lock); state=state_failed; return;
+			}
+			w=levels[0].w; h=levels[0].h;
+			if (mipmaps) texture_build_mipmaps(levels);
+			if (compressed()) {
+				printf("Compressing texture '%s' to cache\n",files[f].c_str());
+				texture_compress_bc4(levels,channel);
+				texcache_save(cachefile,key,levels);
+			}
+		}
+		if (hook_texels) { // show the hook our channel, as the shader will see it
+			const texture_level &l0=faces[0][0];
+			std::vector<unsigned char> texels;
+			if (compressed()) bc4_decompress(l0,texels);
+			else {
+				texels.resize(w*h);
+				const unsigned char *rgba=(const unsigned char *)&l0.pixels[0];
+				for (int i=0;i<w*h;i++) texels[i]=rgba[4*i+channel];
+			}
+			decode_hook(&texels[0],w,h);
+		}
+		porlock_scoped l(&lock);
+		this->w=w; this->h=h;
+		state=state_decoded;
+	}
+
+	/* Called by the render thread: upload up to budget bytes of pixels
+	   through this pixel buffer object.  Returns the bytes uploaded. */
+	size_t upload(size_t budget,GLuint pbo) {
+		if (!decoded() || finished()) return 0;
+		if (state==state_decoded) start_upload();
+		glBindTexture(target,dest);
+		size_t sent=0;
+		while (sent<budget || sent==0) {
+			level_t &l=faces[face][level];
+			// Upload whole rows: of pixels, or of 4x4 compressed blocks
+			int texel_rows=compressed()?4:1;
+			size_t rowbytes=compressed()?bc4_size(l.w,1):4*l.w;
+			int nrows=(l.h+texel_rows-1)/texel_rows;
+			size_t fit=(budget>sent)?(budget-sent)/rowbytes:0; // rows that fit in budget
+			int rows=(int)std::max((size_t)1,std::min((size_t)(nrows-row),fit));
+			size_t bytes=rowbytes*rows;
+			glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB,pbo);
+			glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB,bytes,NULL,GL_STREAM_DRAW_ARB); // orphan
+			void *dest=glMapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB,GL_WRITE_ONLY_ARB);
+			memcpy(dest,(const char *)&l.pixels[0]+row*rowbytes,bytes);
+			glUnmapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB);
+			int y=row*texel_rows, ht=std::min(l.h-y,rows*texel_rows);
+			if (compressed())
+				glCompressedTexSubImage2DARB(face_target(face),level,0,y,l.w,ht,
+					format,bytes,(void *)0);
+			else
+				glTexSubImage2D(face_target(face),level,0,y,l.w,ht,
+					GL_RGBA,GL_UNSIGNED_BYTE,(void *)0);
+			glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB,0);
+			sent+=bytes;
+			row+=rows;
+			if (row>=nrows && next_level()) break;
+		}
+		return sent;
+	}
+
+protected:
+	/* If hook_texels is set, this is called on the worker thread with
+	   our level 0 texels (of face 0), one byte each from our channel,
+	   bottom row first, as the shader will see them. */
+	bool hook_texels;
+	virtual void decode_hook(const unsigned char *texels,int w,int h) {}
+
+private:
+	typedef texture_level level_t;
+	std::vector< std::vector<level_t> > faces; // [face][level]
+
+	GLenum target, format;
+	int channel; // source channel we compress
+	std::vector<std::string> files;
+	bool flip, mipmaps;
+	porlock lock;
+	enum {state_queued=0, state_decoded, state_uploading, state_done, state_failed};
+	int state;
+	GLuint dest; // texture we're uploading to
+	int face, level, row; // next rows to upload
+
+	bool compressed(void) const { return format==GL_COMPRESSED_RED_RGTC1; }
+
+	GLenum face_target(int f) const {
+		return target==GL_TEXTURE_2D?GL_TEXTURE_2D:GL_TEXTURE_CUBE_MAP_POSITIVE_X+f;
+	}
+
+	/* Make our texture a 1x1 black placeholder */
+	void make_placeholder(void) {
+		unsigned int black=0;
+		glGenTextures(1,&tex);
+		glBindTexture(target,tex);
+		for (int f=0;f<(target==GL_TEXTURE_2D?1:6);f++)
+			glTexImage2D(face_target(f),0,compressed()?GL_LUMINANCE8:format,1,1,0,
+				GL_RGBA,GL_UNSIGNED_BYTE,&black);
+		glTexParameteri(target,GL_TEXTURE_MAX_LEVEL,0);
+		glBindTexture(target,0);
+	}
+
+	/* Allocate storage for our pixels, and aim at the coarsest level */
+	void start_upload(void) {
+		int top=faces[0].size()-1; // coarsest level
+		if (target==GL_TEXTURE_2D) dest=tex; // refine in place, coarsest first
+		else glGenTextures(1,&dest); // swap in when complete
+		glBindTexture(target,dest);
+		for (unsigned int f=0;f<faces.size();f++)
+		for (int l=0;l<=top;l++) {
+			const level_t &lv=faces[f][l];
+			if (compressed())
+				glCompressedTexImage2DARB(face_target(f),l,format,lv.w,lv.h,0,bc4_size(lv.w,lv.h),NULL);
+			else
+				glTexImage2D(face_target(f),l,format,lv.w,lv.h,0,GL_RGBA,GL_UNSIGNED_BYTE,NULL);
+		}
+		if (compressed()) { // read red as luminance
+			glTexParameteri(target,GL_TEXTURE_SWIZZLE_G_EXT,GL_RED);
+			glTexParameteri(target,GL_TEXTURE_SWIZZLE_B_EXT,GL_RED);
+		}
+		glTexParameteri(target,GL_TEXTURE_BASE_LEVEL,top);
+		glTexParameteri(target,GL_TEXTURE_MAX_LEVEL,top);
+		face=0; level=top; row=0;
+		porlock_scoped l(&lock); state=state_uploading;
+	}
+
+	/* We just finished uploading a level: move on.  Returns true when done. */
+	bool next_level(void) {
+		row=0;
+		if (target==GL_TEXTURE_2D) glTexParameteri(target,GL_TEXTURE_BASE_LEVEL,level);
+		if (level>0) { level--; return false; }
+		level=faces[0].size()-1;
+		if (++face<(int)faces.size()) return false;
+
+		// Everything is uploaded
+		if (dest!=tex) { glDeleteTextures(1,&tex); tex=dest; }
+		faces.clear(); // free our copy of the pixels
+		porlock_scoped l(&lock); state=state_done;
+		return true;
+	}
+};
+
+
+/** Decodes textures on background threads, and uploads them a bit each frame. */
+class async_texture_loader {
+public:
+	async_texture_loader() :next(0), pbo(0), started(false), start_time(0.0) {}
+
+	/* Queue up this texture to load.  Call before start(). */
+	async_texture *add(async_texture *t) { textures.push_back(t); return t; }
+
+	/* Start decoding with this many worker threads */
+	void start(int threads=2) {
+		glGenBuffersARB(1,&pbo);
+		start_time=0.001*glutGet(GLUT_ELAPSED_TIME);
+		for (int i=0;i<threads;i++) porthread_detach(porthread_create(worker,this));
+		started=true;
+	}
+
+	/* Call once per frame, from the render thread: upload up to budget bytes.
+	   Returns true once everything is loaded. */
+	bool update(size_t budget) {
+		if (!started) return true;
+		glActiveTexture(GL_TEXTURE0); // don't disturb the textures the shader uses
+		bool done=true;
+		size_t sent=0;
+		for (unsigned int i=0;i<textures.size();i++) {
+			if (sent<budget) sent+=textures[i]->upload(budget-sent,pbo);
+			if (!textures[i]->finished()) done=false;
+		}
+		glBindTexture(GL_TEXTURE_2D,0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP,0);
+		if (done) {
+			printf("Textures loaded in %.2f seconds\n",0.001*glutGet(GLUT_ELAPSED_TIME)-start_time);
+			started=false;
+		}
+		return done;
+	}
+
+	/* Block until everything is loaded (e.g., for benchmarking) */
+	void finish(void) {
+		while (!update((size_t)-1)) porthread_yield(1);
+	}
+
+private:
+	std::vector<async_texture *> textures;
+	porlock lock; // protects next
+	unsigned int next; // next texture to decode
+	GLuint pbo; // pixel unpack buffer, for uploads
+	bool started;
+	double start_time;
+
+	/* Worker thread: decode textures until there are none left */
+	static void worker(void *arg) {
+		async_texture_loader *l=(async_texture_loader *)arg;
+		while (true) {
+			async_texture *t=NULL;
+			{
+				porlock_scoped s(&l->lock);
+				if (l->next<l->textures.size()) t=l->textures[l->next++];
+			}
+			if (t==NULL) return;
+			t->decode();
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,477 @@
+/**
+  Virtual texturing: page in only the tiles the shader needs.
+
+  The source image is compressed to BC4 (see texcache.h) once, and cut
+  into a pyramid of 128x128 texel tiles, saved next to the source as
+  a .vt file.  Each tile carries a 4 texel border copied from its
+  neighbors, so bilinear filtering never needs a second tile.
+
+  On the GPU, "atlas" is a fixed-size cache of tile slots, and
+  "indirect" has one RGBA8 texel per tile per mip level: (slot x,
+  slot y, level, 255) of the finest resident tile covering it, so
+  missing tiles fall back to a blurrier parent.  GPU memory is
+  bounded by the atlas, whatever the source resolution.
+
+  Each frame, a small feedback render records which tiles the shader
+  wanted (each pixel reports one of the tiles it touched, picked at
+  random), and a worker thread reads those tiles from disk.  The
+  render thread uploads them through a pixel buffer object, evicting
+  the least recently wanted tiles.  The coarsest tile stays resident.
+
+  The GLSL half of this is vt_sample() in raytrace.txt.
+  (Public Domain)
+*/
+#ifndef __AURORA_VIRTUALTEX_H
+#define __AURORA_VIRTUALTEX_H
+
+#include <vector>
+#include <string>
+#include <climits>
+#include "texcache.h"
+
+enum {
+	vt_tile=128, // texels across each tile
+	vt_border=4, // border texels on each side (one BC4 block)
+	vt_slot=vt_tile+2*vt_border, // texels across each atlas slot
+	vt_slot_bytes=vt_slot*vt_slot/2, // BC4 bytes per tile
+	vt_magic=0x31545641 // "AVT1", at the start of a .vt file
+};
+
+/** A virtual texture, streamed into a tile atlas by feedback. */
+class virtual_texture {
+public:
+	GLuint atlas, indirect; // OpenGL textures
+	int slots; // atlas slots across (and down)
+	int w,h; // size of level 0 (1 until the tile file is open)
+	int top; // coarsest level: a single tile
+	int n0; // indirection texels across level 0 (a power of two)
+	bool overfull; // last update() had more wanted tiles than atlas slots
+
+	/* Page in channel c of this image, into an atlas of slots x slots tiles. */
+	virtual_texture(const std::string &file_,int channel_,int slots_=32)
+		:slots(slots_), w(1), h(1), top(0), n0(1), overfull(false), hook_tiles(false),
+		 file(file_), channel(channel_), state(state_opening), tiles(NULL), reading(false),
+		 stopping(false), started(false),
+		 opened(false), dirty(false), frame(1), fb(NULL), pack(0), unpack(0), readback(false)
+	{
+		int s=slots*vt_slot;
+		glGenTextures(1,&atlas);
+		glBindTexture(GL_TEXTURE_2D,atlas);
+		glCompressedTexImage2DARB(GL_TEXTURE_2D,0,GL_COMPRESSED_RED_RGTC1,s,s,0,bc4_size(s,s),NULL);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAX_LEVEL,0);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+
+		unsigned int empty=0; // nothing resident anywhere
+		glGenTextures(1,&indirect);
+		glBindTexture(GL_TEXTURE_2D,indirect);
+		glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA8,1,1,0,GL_RGBA,GL_UNSIGNED_BYTE,&empty);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAX_LEVEL,0);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D,0);
+
+		glGenBuffersARB(1,&pack);
+		glGenBuffersARB(1,&unpack);
+	}
+	/* Stop the worker thread (after it opens the tile file, if it's still at that) */
+	virtual ~virtual_texture() {
+		{ porlock_scoped l(&lock); stopping=true; }
+		wake.broadcast();
+		if (started) porthread_wait(thread);
+		if (tiles) fclose(tiles);
+	}
+
+	/* Start the worker thread, which builds or opens the tile file, then reads tiles */
+	void start(void) {
+		thread=porthread_create(worker,this);
+		started=true;
+	}
+
+	/* Return true once the tile file is open (and any tile hook has run) */
+	bool decoded(void) { porlock_scoped l(&lock); return state==state_ready; }
+	/* Return true if the tile file couldn't be opened or built */
+	bool failed(void) { porlock_scoped l(&lock); return state==state_failed; }
+
+	/* Return true if every tile we've asked for is resident */
+	bool idle(void) { porlock_scoped l(&lock); return state!=state_opening && pending.empty() && loaded.empty() && !reading; }
+
+	/**
+	  Render our feedback pass with this shader and proxy, into a small framebuffer
+	  (a 1/16 scale copy of this wid x ht screen).  The shader should choose
+	  levels for this full-screen pixel footprint.  The requests are read back
+	  asynchronously, and processed by the next update().
+	*/
+	void feedback(GLhandleARB prog,multigrid_proxy &proxy,int wid,int ht,float footprint) {
+		if (!opened) return;
+		int fw=std::max(1,wid>>4), fh=std::max(1,ht>>4);
+		if (fb==NULL || fb->w!=fw || fb->h!=fh) { delete fb; fb=new oglFramebuffer(fw,fh,GL_RGBA8); }
+		glFastUniform1f(prog,"vt_feedback",1.0f);
+		glFastUniform1f(prog,"vt_seed",(float)(frame%1024));
+		glFastUniform1f(prog,"multigridCoarsest",1.0f);
+		glFastUniform1f(prog,"multigridFootprint",footprint);
+		fb->bind();
+		glClearColor(0.0,0.0,0.0,0.0);
+		glClear(GL_COLOR_BUFFER_BIT);
+		proxy.draw();
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,pack);
+		glBufferDataARB(GL_PIXEL_PACK_BUFFER_ARB,4*fw*fh,NULL,GL_STREAM_READ_ARB);
+		glReadPixels(0,0,fw,fh,GL_RGBA,GL_UNSIGNED_BYTE,(void *)0);
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+		fb->unbind();
+		glFastUniform1f(prog,"vt_feedback",0.0f);
+		readback=true;
+	}
+
+	/* Call once per frame, from the render thread: process the last feedback,
+	   and upload up to this many newly loaded tiles. */
+	void update(int max_tiles=64) {
+		if (!opened) {
+			if (!decoded()) return;
+			open_indirect();
+		}
+		frame++;
+		if (readback) read_feedback();
+
+		// Upload newly loaded tiles
+		glActiveTexture(GL_TEXTURE0); // don't disturb the textures the shader uses
+		glBindTexture(GL_TEXTURE_2D,atlas);
+		overfull=false;
+		for (int n=0;n<max_tiles;n++) {
+			loaded_tile t;
+			{
+				porlock_scoped l(&lock);
+				if (loaded.empty()) break;
+				t=loaded.back(); loaded.pop_back();
+			}
+			if (wanted[t.id]<frame-30) { queued[t.id]=false; continue; } // nobody wants it anymore
+			int s=free_slot();
+			if (s<0) { // every slot is in use this frame: keep it for later
+				porlock_scoped l(&lock);
+				loaded.insert(loaded.begin(),t);
+				overfull=true;
+				break;
+			}
+			queued[t.id]=false;
+			upload_tile(s,t);
+		}
+		glBindTexture(GL_TEXTURE_2D,0);
+		if (dirty) upload_indirect();
+	}
+
+	/* Block until the tiles for this view are resident, or the atlas
+	   is full (e.g., for benchmarking) */
+	void finish(GLhandleARB prog,multigrid_proxy &proxy,int wid,int ht,float footprint) {
+		while (!decoded()) {
+			if (failed()) {
+				printf("Can't benchmark without virtual texture '%s'\n",file.c_str());
+				exit(1);
+			}
+			porthread_yield(1);
+		}
+		for (int quiet=0;quiet<4;) { // a few frames without new requests
+			feedback(prog,proxy,wid,ht,footprint);
+			update(INT_MAX);
+			if (idle() || overfull) quiet++;
+			else { quiet=0; porthread_yield(1); }
+		}
+	}
+
+protected:
+	/* If hook_tiles is set, this is called on the worker thread, for each level 0
+	   tile when the tile file is opened, with the texels the shader will see:
+	   texels[x+y*pitch] is level 0 texel (x0+x,y0+y), for x<tw and y<th. */
+	bool hook_tiles;
+	virtual void tile_hook(const unsigned char *texels,int pitch,int x0,int y0,int tw,int th) {}
+
+private:
+	std::string file;
+	int channel;
+	porlock lock; // protects state, pending, loaded, reading, and stopping
+	porcond wake; // signalled when pending grows, or we're stopping
+	enum {state_opening=0, state_ready, state_failed};
+	int state;
+	FILE *tiles; // open .vt file (worker thread only)
+	std::vector<int> level_start, level_ntx, level_nty; // first tile ID, and tiles across, per level
+
+	// Worker thread's queues
+	class loaded_tile {
+	public:
+		int id;
+		std::vector<unsigned int> blocks; // BC4 blocks
+	};
+	std::vector<int> pending; // tile IDs to read
+	std::vector<loaded_tile> loaded; // tiles read, but not uploaded
+	bool reading; // worker is reading a tile
+	bool stopping; // worker should exit
+	porthread_t thread; // the worker
+	bool started; // thread is running
+
+	// Render thread's state
+	bool opened, dirty;
+	int frame;
+	std::vector<int> slot_of; // atlas slot of each tile ID, or -1
+	std::vector<int> tile_in_slot; // tile ID in each atlas slot, or -1
+	std::vector<int> wanted; // frame each tile ID was last requested (INT_MAX if pinned)
+	std::vector<bool> queued; // tile ID is pending or loaded
+	std::vector< std::vector<unsigned char> > ind; // indirection texels, per level
+	oglFramebuffer *fb; // feedback pass
+	GLuint pack, unpack; // pixel buffer objects: feedback readback, tile upload
+	bool readback; // pack holds feedback
+
+	int tile_id(int level,int x,int y) const { return level_start[level]+x+y*level_ntx[level]; }
+
+	/* Fill in our per-level tile layout, from w and h */
+	void make_layout(void) {
+		level_start.clear(); level_ntx.clear(); level_nty.clear();
+		int start=0;
+		for (int l=0;;l++) {
+			int tx=((w>>l)+vt_tile-1)/vt_tile, ty=((h>>l)+vt_tile-1)/vt_tile;
+			level_start.push_back(start); level_ntx.push_back(tx); level_nty.push_back(ty);
+			start+=tx*ty;
+			if (tx<=1 && ty<=1) { top=l; break; }
+		}
+		level_start.push_back(start); // total tiles
+		n0=1;
+		while (n0<level_ntx[0] || n0<level_nty[0]) n0*=2;
+	}
+
+	/* Worker thread: open (or build) the tile file, then read requested tiles */
+	static void worker(void *arg) {
+		virtual_texture *v=(virtual_texture *)arg;
+		if (!v->open_tiles()) {
+			porlock_scoped l(&v->lock); v->state=state_failed; return;
+		}
+		if (v->hook_tiles) v->run_hook();
+		{ porlock_scoped l(&v->lock); v->state=state_ready; v->reading=false; }
+		while (true) {
+			loaded_tile t; t.id=-1;
+			{ // coarsest tiles first: their fallbacks cover the most screen
+				porlock_scoped l(&v->lock);
+				while (v->pending.empty() && !v->stopping) v->wake.wait(v->lock);
+				if (v->stopping) return;
+				for (unsigned int i=0;i<v->pending.size();i++)
+					if (t.id<0 || v->pending[i]>t.id) t.id=v->pending[i];
+				v->pending.erase(std::find(v->pending.begin(),v->pending.end(),t.id));
+				v->reading=true;
+			}
+			v->read_tile(t.id,t.blocks);
+			porlock_scoped l(&v->lock);
+			v->loaded.push_back(t);
+			v->reading=false;
+		}
+	}
+
+	/* Read this tile's BC4 blocks from the tile file */
+	void read_tile(int id,std::vector<unsigned int> &blocks) {
+		blocks.resize(vt_slot_bytes/4);
+		fseek(tiles,4*10+(long)id*vt_slot_bytes,SEEK_SET);
+		if (fread(&blocks[0],vt_slot_bytes,1,tiles)!=1)
+			memset(&blocks[0],0,vt_slot_bytes);
+	}
+
+	/* Open our tile file, first building it from the source image if needed */
+	bool open_tiles(void) {
+		std::vector<unsigned char> src;
+		if (!texcache_read_file(file,src)) {
+			printf("Error loading virtual texture '%s': can't read file\n",file.c_str());
+			return false;
+		}
+		texcache_key key(file,src,channel);
+		std::string vtfile=file+".vt";
+		if (check_tiles(vtfile,key)) return true;
+
+		printf("Building virtual texture tiles for '%s'\n",file.c_str());
+		std::vector<texture_level> levels(1);
+		if (!texture_decode(file,src,true,levels[0])) return false;
+		src.clear();
+		w=levels[0].w; h=levels[0].h;
+		make_layout();
+		texture_build_mipmaps(levels);
+		texture_compress_bc4(levels,channel);
+		if ((int)levels.size()<=top) {
+			printf("Virtual texture '%s' is too thin to tile\n",file.c_str());
+			return false;
+		}
+		write_tiles(vtfile,key,levels);
+		return check_tiles(vtfile,key);
+	}
+
+	/* Open this tile file, and check it was made from key's source */
+	bool check_tiles(const std::string &vtfile,const texcache_key &key) {
+		tiles=fopen(vtfile.c_str(),"rb");
+		if (tiles==NULL) return false;
+		unsigned int head[10];
+		if (fread(head,sizeof(head),1,tiles)==1 && head[0]==vt_magic &&
+			head[1]==key.hash_lo && head[2]==key.hash_hi && head[3]==key.mtime && head[4]==key.channel &&
+			head[7]==vt_tile && head[8]==vt_border)
+		{
+			w=head[5]; h=head[6];
+			make_layout();
+			fseek(tiles,0,SEEK_END);
+			if (ftell(tiles)==4*10+(long)level_start.back()*vt_slot_bytes) return true;
+		}
+		fclose(tiles); tiles=NULL; // stale or truncated
+		return false;
+	}
+
+	/* Cut these BC4 levels into bordered tiles, and write them to this tile file */
+	void write_tiles(const std::string &vtfile,const texcache_key &key,const std::vector<texture_level> &levels) {
+		std::string tmp=vtfile+".tmp"; // rename when complete, so we never leave half a file
+		FILE *f=fopen(tmp.c_str(),"wb");
+		if (f==NULL) { printf("Can't write virtual texture tiles '%s'\n",tmp.c_str()); return; }
+		unsigned int head[10]={vt_magic,key.hash_lo,key.hash_hi,key.mtime,key.channel,
+			(unsigned int)w,(unsigned int)h,vt_tile,vt_border,0};
+		bool ok=fwrite(head,sizeof(head),1,f)==1;
+		const int sb=vt_slot/4, tb=vt_tile/4; // BC4 blocks across a slot, and a tile
+		std::vector<unsigned int> tile(vt_slot_bytes/4);
+		for (int l=0;l<=top;l++) {
+			const texture_level &lv=levels[l];
+			int bw=(lv.w+3)/4, bh=(lv.h+3)/4;
+			for (int ty=0;ty<level_nty[l];ty++)
+			for (int tx=0;tx<level_ntx[l];tx++) {
+				for (int j=0;j<sb;j++)
+				for (int i=0;i<sb;i++) { // border blocks clamp at the image edge
+					int bx=std::max(0,std::min(bw-1,tx*tb-1+i));
+					int by=std::max(0,std::min(bh-1,ty*tb-1+j));
+					tile[2*(i+j*sb)+0]=lv.pixels[2*(bx+by*bw)+0];
+					tile[2*(i+j*sb)+1]=lv.pixels[2*(bx+by*bw)+1];
+				}
+				ok=ok && fwrite(&tile[0],vt_slot_bytes,1,f)==1;
+			}
+		}
+		if (fclose(f)!=0) ok=false;
+		if (!ok || rename(tmp.c_str(),vtfile.c_str())!=0) {
+			printf("Error writing virtual texture tiles '%s'\n",vtfile.c_str());
+			remove(tmp.c_str());
+		}
+	}
+
+	/* Show tile_hook each level 0 tile */
+	void run_hook(void) {
+		texture_level t; t.w=t.h=vt_slot;
+		std::vector<unsigned char> texels;
+		for (int ty=0;ty<level_nty[0];ty++)
+		for (int tx=0;tx<level_ntx[0];tx++) {
+			read_tile(tile_id(0,tx,ty),t.pixels);
+			bc4_decompress(t,texels);
+			int x0=tx*vt_tile, y0=ty*vt_tile;
+			tile_hook(&texels[vt_border+vt_border*vt_slot],vt_slot,x0,y0,
+				std::min((int)vt_tile,w-x0),std::min((int)vt_tile,h-y0));
+		}
+	}
+
+	/* Render thread: the tile file is open, so set up our indirection and residency */
+	void open_indirect(void) {
+		int ntiles=level_start.back();
+		slot_of.assign(ntiles,-1);
+		wanted.assign(ntiles,0);
+		queued.assign(ntiles,false);
+		tile_in_slot.assign(slots*slots,-1);
+		ind.clear();
+		for (int n=n0;n>=1;n/=2) ind.push_back(std::vector<unsigned char>(4*n*n,0));
+
+		glBindTexture(GL_TEXTURE_2D,indirect);
+		for (unsigned int l=0;l<ind.size();l++)
+			glTexImage2D(GL_TEXTURE_2D,l,GL_RGBA8,n0>>l,n0>>l,0,GL_RGBA,GL_UNSIGNED_BYTE,&ind[l][0]);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAX_LEVEL,ind.size()-1);
+		glBindTexture(GL_TEXTURE_2D,0);
+
+		// Pin the coarsest level, so there's always something to fall back on
+		porlock_scoped l(&lock);
+		for (int id=level_start[top];id<level_start[top+1];id++) {
+			wanted[id]=INT_MAX;
+			queued[id]=true;
+			pending.push_back(id);
+		}
+		wake.signal();
+		opened=true;
+	}
+
+	/* Mark the tiles in last frame's feedback as wanted, and queue any missing ones */
+	void read_feedback(void) {
+		readback=false;
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,pack);
+		const unsigned char *px=(const unsigned char *)glMapBufferARB(GL_PIXEL_PACK_BUFFER_ARB,GL_READ_ONLY_ARB);
+		std::vector<int> missing;
+		if (px) for (int i=0;i<fb->w*fb->h;i++,px+=4) {
+			if (px[3]==0) continue; // no request
+			int x=px[0], y=px[1], l=px[2];
+			if (l>top || x>=level_ntx[l] || y>=level_nty[l]) continue;
+			for (;l<=top;l++,x/=2,y/=2) { // we want its parents too, as fallbacks
+				int id=tile_id(l,x,y);
+				if (wanted[id]>=frame) break; // already got this one (and so its parents)
+				wanted[id]=frame;
+				if (slot_of[id]<0 && !queued[id]) { queued[id]=true; missing.push_back(id); }
+			}
+		}
+		glUnmapBufferARB(GL_PIXEL_PACK_BUFFER_ARB);
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+
+		porlock_scoped l(&lock);
+		for (unsigned int i=0;i<pending.size();i++) // forget requests nobody wants anymore
+			if (wanted[pending[i]]<frame-30) {
+				queued[pending[i]]=false;
+				pending[i--]=pending.back(); pending.pop_back();
+			}
+		pending.insert(pending.end(),missing.begin(),missing.end());
+		if (!missing.empty()) wake.signal();
+	}
+
+	/* Return a free atlas slot, evicting the least recently wanted tile if needed.
+	   Returns -1 if every slot holds a tile wanted this frame. */
+	int free_slot(void) {
+		int best=-1, best_wanted=frame;
+		for (int s=0;s<slots*slots;s++) {
+			int id=tile_in_slot[s];
+			if (id<0) return s;
+			if (wanted[id]<best_wanted) { best=s; best_wanted=wanted[id]; }
+		}
+		if (best>=0) {
+			slot_of[tile_in_slot[best]]=-1;
+			tile_in_slot[best]=-1;
+			dirty=true;
+		}
+		return best;
+	}
+
+	/* Copy this tile into this atlas slot, through our pixel buffer object */
+	void upload_tile(int s,const loaded_tile &t) {
+		glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB,unpack);
+		glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB,vt_slot_bytes,&t.blocks[0],GL_STREAM_DRAW_ARB);
+		glCompressedTexSubImage2DARB(GL_TEXTURE_2D,0,(s%slots)*vt_slot,(s/slots)*vt_slot,
+			vt_slot,vt_slot,GL_COMPRESSED_RED_RGTC1,vt_slot_bytes,(void *)0);
+		glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB,0);
+		slot_of[t.id]=s;
+		tile_in_slot[s]=t.id;
+		dirty=true;
+	}
+
+	/* Point each indirection texel at its finest resident tile, and upload them */
+	void upload_indirect(void) {
+		dirty=false;
+		int nl=ind.size();
+		for (int l=nl-1;l>=0;l--) {
+			int n=n0>>l;
+			for (int y=0;y<n;y++)
+			for (int x=0;x<n;x++) {
+				unsigned char *e=&ind[l][4*(x+y*n)];
+				int s=-1;
+				if (l<=top && x<level_ntx[l] && y<level_nty[l]) s=slot_of[tile_id(l,x,y)];
+				if (s>=0) { e[0]=s%slots; e[1]=s/slots; e[2]=l; e[3]=255; }
+				else if (l+1<nl) memcpy(e,&ind[l+1][4*(x/2+(y/2)*(n/2))],4); // parent's
+				else memset(e,0,4);
+			}
+		}
+		glBindTexture(GL_TEXTURE_2D,indirect);
+		for (int l=0;l<nl;l++)
+			glTexSubImage2D(GL_TEXTURE_2D,l,0,0,n0>>l,n0>>l,GL_RGBA,GL_UNSIGNED_BYTE,&ind[l][0]);
+		glBindTexture(GL_TEXTURE_2D,0);
+	}
+};
+
+#endif
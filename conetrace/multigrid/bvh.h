@@ -0,0 +1,138 @@
+/**
+  Bounding volume hierarchy over the conetracer's spheres.
+
+  The hierarchy is rebuilt on the CPU every frame (it's just a sort),
+  then streamed to texture buffers that the shader walks without a stack:
+  nodes are stored in depth-first order, and each node knows the
+  "escape" node to continue with if the cone misses its box.
+
+  Texture buffer layout, all GL_RGBA32F texels:
+  	bvhTex: 2 texels per node
+  		lo.xyz, escape node index
+  		hi.xyz, -1 for interior nodes, or first_sphere*8+sphere_count for leaves
+  	sphereTex: 3 texels per sphere, in leaf order
+  		center.xyz, radius
+  		reflectance.rgb, mirror
+  		shiny, density, 0, 0  (Public Domain)
+*/
+#ifndef __CONETRACE_BVH_H
+#define __CONETRACE_BVH_H
+
+#include <vector>
+#include <algorithm>
+#include "osl/vec4.h"
+
+/** One sphere in the conetraced scene */
+class scene_sphere {
+public:
+	vec3 center; float r;
+	vec3 reflectance; // diffuse color
+	float mirror; // proportion of mirror reflection
+	float shiny; // 0: totally matte surface; 1: big phong highlight
+	float density; // if <1.0, object is volume rendered
+
+	scene_sphere(const vec3 &c,float r_,const vec3 &refl,float mirror_,
+			float shiny_=1.0,float density_=1.01)
+		:center(c), r(r_), reflectance(refl), mirror(mirror_), 
+		 shiny(shiny_), density(density_) {}
+};
+
+/** A GL_RGBA32F texture buffer object, for streaming texels to the shader. */
+class texel_buffer {
+public:
+	GLuint buf, tex;
+	texel_buffer() :buf(0), tex(0) {}
+	
+	/* Replace our contents with these texels */
+	void upload(const std::vector<vec4> &texels) {
+		if (buf==0) { // first time: make buffer and texture
+			glGenBuffersARB(1,&buf);
+			glGenTextures(1,&tex);
+		}
+		glBindBufferARB(GL_TEXTURE_BUFFER_ARB,buf);
+		vec4 empty(0.0f); // never make a zero-size buffer
+		const vec4 *src=texels.size()?&texels[0]:&empty;
+		int bytes=sizeof(vec4)*(texels.size()?texels.size():1);
+		glBufferDataARB(GL_TEXTURE_BUFFER_ARB,bytes,src,GL_STREAM_DRAW_ARB); // orphans old data
+		glBindBufferARB(GL_TEXTURE_BUFFER_ARB,0);
+	}
+	
+	/* Bind us to this texture unit */
+	void bind(int unit) {
+		glActiveTexture(GL_TEXTURE0+unit);
+		glBindTexture(GL_TEXTURE_BUFFER_ARB,tex);
+		glTexBufferARB(GL_TEXTURE_BUFFER_ARB,GL_RGBA32F_ARB,buf);
+		glActiveTexture(GL_TEXTURE0);
+	}
+};
+
+/** Stackless BVH, stored as texels for upload to the GPU. */
+class sphere_bvh {
+public:
+	enum {leaf_max=4}; // spheres per leaf node (must be less than 8)
+
+	std::vector<vec4> nodes; // 2 texels per node
+	std::vector<vec4> spheres; // 3 texels per sphere
+
+	/* Rebuild the hierarchy around these spheres */
+	void build(const std::vector<scene_sphere> &s) {
+		nodes.clear(); spheres.clear();
+		if (s.size()==0) return;
+		std::vector<int> idx(s.size());
+		for (unsigned int i=0;i<s.size();i++) idx[i]=i;
+		build_node(s,&idx[0],0,s.size());
+	}
+
+	/* Return the number of nodes in the hierarchy */
+	int node_count(void) const { return nodes.size()/2; }
+
+private:
+	/* Sorts spheres by their center along one axis */
+	class axis_less {
+	public:
+		const std::vector<scene_sphere> &s; int axis;
+		axis_less(const std::vector<scene_sphere> &s_,int axis_) :s(s_), axis(axis_) {}
+		bool operator()(int a,int b) const { return s[a].center[axis]<s[b].center[axis]; }
+	};
+
+	/* Build the node for spheres idx[start..end), and return its index */
+	int build_node(const std::vector<scene_sphere> &s,int *idx,int start,int end) {
+		int node=node_count();
+		nodes.push_back(vec4(0.0f)); nodes.push_back(vec4(0.0f));
+
+		// Bounds of the spheres, and of their centers
+		vec3 lo=s[idx[start]].center, hi=lo, clo=lo, chi=lo;
+		for (int i=start;i<end;i++) {
+			const scene_sphere &p=s[idx[i]];
+			lo=min(lo,p.center-vec3(p.r)); hi=max(hi,p.center+vec3(p.r));
+			clo=min(clo,p.center); chi=max(chi,p.center);
+		}
+
+		float leaf=-1.0;
+		if (end-start<=leaf_max) { // leaf: list spheres
+			leaf=(spheres.size()/3)*8+(end-start);
+			for (int i=start;i<end;i++) {
+				const scene_sphere &p=s[idx[i]];
+				spheres.push_back(vec4(p.center,p.r));
+				spheres.push_back(vec4(p.reflectance,p.mirror));
+				spheres.push_back(vec4(p.shiny,p.density,0.0,0.0));
+			}
+		}
+		else { // interior: split at median along longest axis of centers
+			vec3 ext=chi-clo;
+			int axis=0;
+			if (ext.y>ext[axis]) axis=1;
+			if (ext.z>ext[axis]) axis=2;
+			int mid=(start+end)/2;
+			std::nth_element(idx+start,idx+mid,idx+end,axis_less(s,axis));
+			build_node(s,idx,start,mid);
+			build_node(s,idx,mid,end);
+		}
+
+		nodes[2*node+0]=vec4(lo,node_count()); // escape: skip our subtree
+		nodes[2*node+1]=vec4(hi,leaf);
+		return node;
+	}
+};
+
+#endif
@@ -6,6 +6,7 @@
   Dr. Orion Sky Lawlor, lawlor@alaska.edu, 2014-06-04 (Public Domain)
 */
 #include "physics/world.h" /* physics::library and physics::object */
+#include "ogl/headless.h" /* -headless: render offscreen with EGL */
 #include "ogl/glsl.h"
 
 /* Just include library bodies here, for easy linking */
@@ -16,6 +17,7 @@
 
 #define multigrid_levels 2 /* 2 looks best; 4 makes artifacts more obvious */
 #include "multigrid.h" /* multigrid renderer */
+#include "bvh.h" /* sphere hierarchy for the shader */
 
 
 class sphereProxy : public multigrid_proxy {
@@ -30,14 +32,53 @@ public:
 
 
 
-/* A raytraced object */
+/* One sphere in the scene.  It doesn't draw itself: 
+   the rayObject collects all the spheres and raytraces them. */
+class sphereObject : public physics::object {
+public:
+	scene_sphere s;
+	sphereObject(const scene_sphere &s_) 
+		:physics::object(0.01), s(s_) {}
+	
+	void draw(physics::library &lib) { }
+};
+
+/* A small black sphere that follows the camera around */
+class cameraSphere : public sphereObject {
+public:
+	cameraSphere() 
+		:sphereObject(scene_sphere(camera,0.2, vec3(0.0,0.0,0.0),0.0)) {}
+	
+	/* Camera moves even while paused, so follow it every frame. */
+	void draw(physics::library &lib) { s.center=camera; }
+};
+
+/* A sphere that bobs up and down above the green sphere */
+class floatingSphere : public sphereObject {
+public:
+	float phase; // offset to animation time
+	floatingSphere(const scene_sphere &s_,float phase_) 
+		:sphereObject(s_), phase(phase_) {}
+	
+	void simulate(physics::library &lib) {
+		s.center.z=fabs(3.0*sin(phase+lib.time));
+	}
+};
+
+
+/* Raytraces all the sphereObjects in the world */
 class rayObject : public physics::object {
 public:
 	double threshold;
+	double deadline; // milliseconds the multigrid levels may take (0: no limit)
+	sphere_bvh bvh;
+	texel_buffer bvhTex, sphereTex;
+	
 	rayObject(void) 
 		:physics::object(0.01)  /* <- our timestep, in seconds */
 	{ 
 		threshold=0.7;
+		deadline=physics_cfg::value("multigrid","deadline",0.0,"milliseconds of GPU time per frame (0: no limit)",0.0,1000.0);
 	}
 	
 	void simulate(physics::library &lib) { }
@@ -49,14 +90,27 @@ public:
 		glUseProgramObjectARB(prog);
 		unsigned int ul=glGetUniformLocationARB(prog,"camera");
 		glUniform3fvARB(ul,1,camera);
-		ul=glGetUniformLocationARB(prog,"time");
-		static double time=0.0;
-		time+=lib.dt;
-		glUniform1fARB(ul,time);
+		
+		/* Gather up the scene, and stream it to the shader */
+		std::vector<scene_sphere> spheres;
+		for (unsigned int i=0;i<lib.world->objects.size();i++) {
+			sphereObject *o=dynamic_cast<sphereObject *>(lib.world->objects[i]);
+			if (o) spheres.push_back(o->s);
+		}
+		bvh.build(spheres);
+		bvhTex.upload(bvh.nodes);
+		bvhTex.bind(1);
+		glFastUniform1i(prog,"bvhTex",1);
+		glFastUniform1i(prog,"bvhNodes",bvh.node_count());
+		sphereTex.upload(bvh.spheres);
+		sphereTex.bind(2);
+		glFastUniform1i(prog,"sphereTex",2);
 
 #if 1 /* multigrid */
 		make_multigrid_renderer;
 		sphereProxy proxy;
+		renderer->fovy=lib.fov;
+		renderer->deadline=deadline;
 		renderer->render(prog,threshold,proxy);
 #else /* direct rendering */
 		/* Draw raytracer proxy geometry *HUGE* (to cover everything) */
@@ -71,7 +125,29 @@ public:
 
 /* Called to create a new simulation */
 void physics_setup(physics::library &lib) {
+	lib.world->add(new cameraSphere());
+	
+	// Big brown sphere
+	lib.world->add(new sphereObject(scene_sphere(
+		vec3(0.0,0.0,-115.0),105.0, vec3(0.4,0.3,0.2),0.0)));
+	
+	// Little green sphere
+	lib.world->add(new sphereObject(scene_sphere(
+		vec3(0.0,0.0,-11.0),10.7, vec3(0.2,0.6,0.4),0.3)));
+	
+	// Wavy lines of floating red spheres
+	int grid=physics_cfg::value("scene","grid",3,"size of grid of floating spheres",0,100);
+	for (int i=-grid;i<=grid;i++)
+	for (int j=-grid;j<=grid;j++) {
+		float f=0.3*i*j; f-=floor(f); // fract
+		lib.world->add(new floatingSphere(scene_sphere(
+			vec3(i*2.0,j*2.0,0.0),0.3+1.0*f, vec3(0.8,0.4,0.4),0.2),
+			i*j));
+	}
+	
+	// Raytracer goes last, so the spheres are up to date when it draws
 	lib.world->add(new rayObject());
+	
 	lib.background[0]=lib.background[1]=0.6;
 	lib.background[2]=1.0; // light blue
 }
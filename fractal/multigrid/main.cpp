@@ -8,6 +8,8 @@ Orion Sky Lawlor, olawlor@acm.org, 2006/09/15 (Public Domain)
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <vector>
+#include <algorithm>
 
 #include <GL/glew.h> /* GL Extensions Wrangler, http://glew.sourceforge.net/ */
 
@@ -15,6 +17,7 @@ Orion Sky Lawlor, olawlor@acm.org, 2006/09/15 (Public Domain)
 #  include <GL/mpiglut.h> /* MPI-capable GLUT */
 #else
 #  include <GL/glut.h> /* WAS: GL Utilities Toolkit, http://freeglut.sourceforge.net/ */
+#  include "ogl/headless.h" /* -headless: render offscreen with EGL */
 #endif
 #include "osl/vec4.h" /* GLSL-style C++ types, by Orion Lawlor */
 #include "osl/mat4.h"
@@ -29,6 +32,11 @@ using osl::mat4;
 
 #define multigrid_levels 3
 #include "multigrid.h"
+#include "tilecache.h"
+#ifdef USE_MPI
+#  include <mpi.h>
+#endif
+#include "multigrid_tiles.h" /* sort-first distributed rendering (-distribute) */
 
 /* Variables updated by the GUI */
 //float center_x=0.0, center_y=1.0; /* center of mandel zooming */
@@ -37,6 +45,38 @@ double zoom=1.0;
 double threshold=0.1;
 float aspect=1.0;
 int benchmode=0; static int bench_count=0;
+int tilemode=0; // if nonzero, reuse cached tiles across frames
+double tile_megabytes=64.0; // memory budget for cached tiles
+int tiles_per_frame=16; // new tiles rendered per frame (others use coarser tiles)
+int mpi_rank=0, mpi_size=1; // distributed rendering: rank 0 runs the GUI (and any benchmark)
+
+#ifdef USE_MPI
+int distribute_x=0, distribute_y=0; // tiles across and down to split the screen into (-distribute)
+bool distribute_balance=true; // assign tiles by last frame's sample counts (else -static blocks)
+bool mpi_quit=false; // rank 0 is done: everybody exits at the next frame
+multigrid_distributed *distributed=0;
+
+/* Everybody renders what rank 0 sees: share its view at the start of each frame */
+void mpi_sync_view(float &time) {
+	double v[5]={center_x,center_y,zoom,time,mpi_quit?1.0:0.0};
+	MPI_Bcast(v,5,MPI_DOUBLE,0,MPI_COMM_WORLD);
+	center_x=v[0]; center_y=v[1]; zoom=v[2]; time=v[3];
+	if (v[4]!=0.0) exit(0); // atexit finalizes MPI
+}
+void mpi_finalize(void) { MPI_Finalize(); }
+
+/* Points fractal's vertex shader at each tile */
+class fractal_subwindow : public multigrid_subwindow {
+public:
+	oglProgramObject *p;
+	fractal_subwindow(oglProgramObject *p_) :p(p_) {}
+	void set(GLhandleARB prog,const float m[16]) {
+		mat4 sub;
+		for (int i=0;i<16;i++) (&sub[0][0])[i]=m[i];
+		p->set("subwindow",sub);
+	}
+};
+#endif
 
 void Exit(const char *where,const char *why) {
 	fprintf (stderr, "FATAL OpenGL Error in %s: %s\n", where, why);
@@ -56,11 +96,17 @@ class mainObject_t {
 public:
 	mainObject_t();
 	void draw(void);
+private:
+	fractal_tile_cache *cache;
+	multigrid_renderer *tile_renderer;
+	void draw_tiles(oglProgramObject *p,const mat4 &subwindow,float time);
+	void render_tile(oglProgramObject *p,const fractal_tile_key &k);
 };
 
 mainObject_t::mainObject_t()
 {
-	/* nothing to set up here... */
+	cache=new fractal_tile_cache((size_t)(tile_megabytes*1024*1024));
+	tile_renderer=0;
 }
 
 /** Main drawing routine, called by main_display below */
@@ -73,6 +119,15 @@ void mainObject_t::draw(void)
 	p->begin();
 	Check("use");
 	
+	float time;
+	if (benchmode)
+		time=0.125*bench_count;
+	else
+		time=0.001*glutGet(GLUT_ELAPSED_TIME);
+#ifdef USE_MPI
+	mpi_sync_view(time);
+#endif
+	
 	/* Copy center_x and center_y into program uniforms */
 	float fc_x=float(center_x);
 	float fl_x=float(center_x-fc_x); // multiprecision low word
@@ -86,10 +141,7 @@ void mainObject_t::draw(void)
 	p->set("zoom",zoom);
 	
 	p->set("aspect",glutGet(GLUT_WINDOW_WIDTH)/float(glutGet(GLUT_WINDOW_HEIGHT)));
-	if (benchmode)
-		p->set("time",0.125*bench_count);
-	else
-		p->set("time",0.001*glutGet(GLUT_ELAPSED_TIME));
+	p->set("time",time);
 
 	/* multiply incoming matrix by subwindow matrix (happens automatically with glLoadMatrix!) */
 	mat4 subwindow=mat4(1.0);
@@ -98,9 +150,35 @@ void mainObject_t::draw(void)
 #endif
 	p->set("subwindow",subwindow);
 
-	make_multigrid_renderer;
-	multigrid_proxy proxy;
-	renderer->render(p->get(),threshold,proxy);
+	if (tilemode) {
+		draw_tiles(p,subwindow,time);
+	}
+#ifdef USE_MPI
+	else if (distributed) {
+		multigrid_proxy proxy;
+		fractal_subwindow sub(p);
+		distributed->render(p->get(),threshold,proxy,sub);
+		p->set("subwindow",subwindow);
+		if (mpi_rank==0 && benchmode) { // how even was the work?
+			std::vector<double> samples=distributed->tiles.loads(distributed->tiles.cost);
+			double smax=0.0, ssum=0.0, bmax=0.0, bsum=0.0;
+			for (int r=0;r<mpi_size;r++) {
+				smax=std::max(smax,samples[r]); ssum+=samples[r];
+				bmax=std::max(bmax,distributed->busy[r]); bsum+=distributed->busy[r];
+			}
+			static FILE *f=fopen("distribute.txt","w");
+			/* bench step, busiest rank's samples and seconds over the average rank's */
+			fprintf(f,"%d	%.3f	%.3f	%.5f	%.5f\n",bench_count,
+				smax*mpi_size/ssum,bmax*mpi_size/bsum,bmax,bsum);
+			fflush(f);
+		}
+	}
+#endif
+	else {
+		make_multigrid_renderer;
+		multigrid_proxy proxy;
+		renderer->render(p->get(),threshold,proxy);
+	}
 		
 	/* Stop using programmable shader */
 	glUseProgramObjectARB(0);
@@ -109,6 +187,105 @@ void mainObject_t::draw(void)
 	glutPostRedisplay();
 }
 
+/** Render the iteration counts for this tile into the cache. */
+void mainObject_t::render_tile(oglProgramObject *p,const fractal_tile_key &k)
+{
+	oglFramebuffer *fb=cache->insert(k);
+	
+	double size=cache->tile_size(k.level);
+	double cx=(k.x+0.5)*size, cy=(k.y+0.5)*size; // tile center
+	float fc_x=float(cx);
+	float fl_x=float(cx-fc_x); // multiprecision low word
+	float fc_y=float(cy);
+	float fl_y=float(cy-fc_y);
+	p->set("center_x",fc_x);
+	p->set("center_y",fc_y);
+	p->set("center_low_x",fl_x);
+	p->set("center_low_y",fl_y);
+	p->set("zoom",0.25*size); // vertex shader spans 4*zoom
+	
+	multigrid_proxy proxy;
+	tile_renderer->render(p->get(),threshold,proxy,fb);
+}
+
+/** 
+  Draw the current view from the tile cache.
+  Missing tiles nearest the center get rendered, up to tiles_per_frame;
+  the rest are drawn from a coarser cached tile until their turn comes.
+*/
+void mainObject_t::draw_tiles(oglProgramObject *p,const mat4 &subwindow,float time)
+{
+	const int T=fractal_tile_cache::tile_pixels;
+	if (!tile_renderer) tile_renderer=new multigrid_renderer(T,T);
+	cache->next_frame();
+	
+	// Pick the quadtree level where tile pixels are at least as fine as screen pixels
+	double pixel=4.0*zoom/glutGet(GLUT_WINDOW_HEIGHT); // fractal units per screen pixel
+	int level=(int)ceil(log2(cache->tile_root_size/(T*pixel)));
+	if (level<0) level=0;
+	double size=cache->tile_size(level);
+	
+	// Range of tiles covering the visible region
+	double half_w=2.0*aspect*zoom, half_h=2.0*zoom;
+	long long x0=(long long)floor((center_x-half_w)/size), x1=(long long)floor((center_x+half_w)/size);
+	long long y0=(long long)floor((center_y-half_h)/size), y1=(long long)floor((center_y+half_h)/size);
+	
+	// Find missing tiles, and sort them nearest the center first
+	typedef std::pair<double,fractal_tile_key> missing_t;
+	std::vector<missing_t> missing;
+	for (long long y=y0;y<=y1;y++)
+	for (long long x=x0;x<=x1;x++) {
+		fractal_tile_key k(level,x,y);
+		if (cache->lookup(k)) continue;
+		double dx=(x+0.5)*size-center_x, dy=(y+0.5)*size-center_y;
+		missing.push_back(missing_t(dx*dx+dy*dy,k));
+	}
+	std::sort(missing.begin(),missing.end());
+	
+	// Render the new tiles
+	unsigned int budget=missing.size();
+	if (!benchmode && budget>(unsigned int)tiles_per_frame) budget=tiles_per_frame;
+	p->set("aspect",1.0f);
+	p->set("iterationsOnly",1.0f);
+	p->set("subwindow",mat4(1.0));
+	for (unsigned int i=0;i<budget;i++) render_tile(p,missing[i].second);
+	p->set("iterationsOnly",0.0f);
+	
+	// Composite the tiles onscreen
+	static oglProgramObject *tp=oglProgramFromFiles("tile_vertex.txt","tile_fragment.txt");
+	tp->begin();
+	tp->set("subwindow",subwindow);
+	tp->set("time",time);
+	tp->set("tiletex",0);
+	for (long long y=y0;y<=y1;y++)
+	for (long long x=x0;x<=x1;x++) {
+		// Use this tile if we have it, or else its nearest cached ancestor
+		fractal_tile_key k(level,x,y), a;
+		oglFramebuffer *fb=0;
+		int up;
+		for (up=0;up<=level && !fb;up++) fb=cache->lookup(a=k.parent(up));
+		if (!fb) continue; // nothing cached here yet
+		up--;
+		
+		// Our part of the ancestor's texture
+		double sub=ldexp(1.0,-up);
+		float s0=(x-a.x*(1LL<<up))*sub, t0=(y-a.y*(1LL<<up))*sub;
+		float s1=s0+sub, t1=t0+sub;
+		
+		// Onscreen location of this tile
+		float sx0=(x*size-center_x)/half_w, sx1=((x+1)*size-center_x)/half_w;
+		float sy0=(y*size-center_y)/half_h, sy1=((y+1)*size-center_y)/half_h;
+		
+		glBindTexture(GL_TEXTURE_2D,fb->get_color());
+		glBegin(GL_QUAD_STRIP);
+		glTexCoord2f(s0,t0); glVertex3f(sx0,sy0,0.0); 
+		glTexCoord2f(s1,t0); glVertex3f(sx1,sy0,0.0); 
+		glTexCoord2f(s0,t1); glVertex3f(sx0,sy1,0.0); 
+		glTexCoord2f(s1,t1); glVertex3f(sx1,sy1,0.0); 
+		glEnd();
+	}
+	glBindTexture(GL_TEXTURE_2D,0);
+}
 
 /******** Program Initialization *********/
 mainObject_t *mainObject=0; /**< Big object we're trying to draw */
@@ -141,13 +318,19 @@ void main_display(void) {
 	run_time+=end_time-start_time;
 	static int frame_count=0;
 	frame_count++;
-	if (benchmode==1 && run_time>0.2 && frame_count>=2) {
+	if (benchmode==1 && mpi_rank==0 && run_time>0.2 && frame_count>=2) {
 		double spf=run_time/frame_count;
 		printf("%d %.2f fps (bench)\n",bench_count,1.0/spf);
 		static FILE *log=fopen("bench.txt","w");
 		fprintf(log,"%d %.2f fps (bench)\n",bench_count,1.0/spf);
 		if ((bench_count%10)==5) oglDumpScreen();
-		if (bench_count>60) exit(0);
+		if (bench_count>60) {
+#ifdef USE_MPI
+			mpi_quit=true; // everybody exits at the next frame
+#else
+			exit(0);
+#endif
+		}
 		zoom*=0.8;
 		frame_count=0; run_time=0.0; bench_count++;
 	}
@@ -177,6 +360,7 @@ void main_key(unsigned char key,int x,int y) {
 	if (key=='d') center_x+=speed;
 	if (key=='q') zoom*=0.9;
 	if (key=='z') zoom*=1.0/0.9;
+	if (key=='t') tilemode=!tilemode;
 	
 	const double limit=1.0e-14; // roundoff atrocious even with double-single here
 	if (zoom<limit) zoom=limit;
@@ -195,11 +379,28 @@ void main_motion(int x,int y) {
 
 int main(int argc, char** argv)
 {
+#ifdef USE_MPI
+	MPI_Init(&argc,&argv);
+	MPI_Comm_rank(MPI_COMM_WORLD,&mpi_rank);
+	MPI_Comm_size(MPI_COMM_WORLD,&mpi_size);
+	atexit(mpi_finalize);
+#endif
 	glutInit(&argc,argv);
+#if defined(USE_MPI) && !defined(USE_MPIGLUT)
+	if (mpi_rank!=0) oglHeadless.save=NULL; // only rank 0 has the whole image
+#endif
 	
 	for (int argi=1;argi<argc;argi++) {
 		if (0==strcmp(argv[argi],"-bench")) { benchmode=1; }
 		if (0==strcmp(argv[argi],"-threshold") && argi+1<argc) { threshold=atof(argv[++argi]); }
+		if (0==strcmp(argv[argi],"-tiles")) { tilemode=1; }
+		if (0==strcmp(argv[argi],"-tilemem") && argi+1<argc) { tilemode=1; tile_megabytes=atof(argv[++argi]); }
+#ifdef USE_MPI
+		if (0==strcmp(argv[argi],"-distribute") && argi+1<argc) { // e.g., 8x8 tiles
+			sscanf(argv[++argi],"%dx%d",&distribute_x,&distribute_y);
+		}
+		if (0==strcmp(argv[argi],"-static")) { distribute_balance=false; }
+#endif
 	}
 	
 	//perf_init();
@@ -223,6 +424,11 @@ int main(int argc, char** argv)
 	
 	// Make an object to draw
 	mainObject=new mainObject_t;
+#ifdef USE_MPI
+	if (distribute_x>0 && distribute_y>0)
+		distributed=new multigrid_distributed(glutGet(GLUT_WINDOW_WIDTH),glutGet(GLUT_WINDOW_HEIGHT),
+			distribute_x,distribute_y,distribute_balance);
+#endif
 
 	glutMainLoop();
 	
@@ -0,0 +1,108 @@
+/**
+  Quadtree cache of rendered Mandelbrot tiles, for reuse across pan and zoom.
+
+  Each tile is a square block of raw iteration counts, covering
+  tile_root_size/2^level fractal units on a side.  Tiles live on the
+  GPU as framebuffer textures, and are keyed by (level, tile x, tile y)
+  in fractal coordinates, so they stay valid as the view moves.
+  Once the tiles exceed the memory budget, the least recently
+  used tiles are recycled for new tiles.  (Public Domain)
+*/
+#ifndef __FRACTAL_TILECACHE_H
+#define __FRACTAL_TILECACHE_H
+
+#include <map>
+#include <list>
+
+/** Names one tile of the quadtree */
+class fractal_tile_key {
+public:
+	int level; // quadtree depth: 0 is the root tile
+	long long x,y; // tile index at this level: tile covers [x,x+1)*size
+
+	fractal_tile_key(int level_=0,long long x_=0,long long y_=0)
+		:level(level_), x(x_), y(y_) {}
+
+	/* Return our ancestor this many levels up the quadtree */
+	fractal_tile_key parent(int up=1) const {
+		return fractal_tile_key(level-up,x>>up,y>>up); // >> rounds toward -infinity
+	}
+
+	bool operator<(const fractal_tile_key &k) const {
+		if (level!=k.level) return level<k.level;
+		if (x!=k.x) return x<k.x;
+		return y<k.y;
+	}
+};
+
+/** Least recently used cache of tile framebuffers */
+class fractal_tile_cache {
+public:
+	enum {tile_pixels=128}; // width and height of each tile, in pixels
+	double tile_root_size; // fractal-space width of level 0 tile
+	size_t budget; // bytes of tile textures to keep resident
+
+	fractal_tile_cache(size_t budget_bytes,double root_size=4.0)
+		:tile_root_size(root_size), budget(budget_bytes), frame(0) {}
+	~fractal_tile_cache() {
+		for (lru_t::iterator it=lru.begin();it!=lru.end();++it) delete it->fb;
+	}
+
+	/* Return the fractal-space width of tiles at this level */
+	double tile_size(int level) const { return ldexp(tile_root_size,-level); }
+
+	/* Bytes used by each tile's texture */
+	static size_t tile_bytes(void) { return tile_pixels*tile_pixels*4; }
+	size_t bytes_used(void) const { return lru.size()*tile_bytes(); }
+
+	/* Start a new frame: tiles touched this frame won't be evicted. */
+	void next_frame(void) { frame++; }
+
+	/* Return the cached tile for this key, or NULL if it's not resident. */
+	oglFramebuffer *lookup(const fractal_tile_key &k) {
+		index_t::iterator it=index.find(k);
+		if (it==index.end()) return NULL;
+		lru.splice(lru.begin(),lru,it->second); // move to front (most recent)
+		it->second->last_frame=frame;
+		return it->second->fb;
+	}
+
+	/* Make room for a new tile with this key, and return its framebuffer.
+	   The caller must render the tile's contents. */
+	oglFramebuffer *insert(const fractal_tile_key &k) {
+		oglFramebuffer *fb=NULL;
+		if (!lru.empty() && bytes_used()+tile_bytes()>budget
+		   && lru.back().last_frame!=frame)
+		{ // recycle the least recently used tile's framebuffer
+			fb=lru.back().fb;
+			index.erase(lru.back().key);
+			lru.pop_back();
+		}
+		else { // allocate a new tile
+			fb=new oglFramebuffer(tile_pixels,tile_pixels,GL_RGBA8);
+			glBindTexture(GL_TEXTURE_2D,fb->get_color());
+			oglTexWrap(GL_CLAMP_TO_EDGE);
+			glBindTexture(GL_TEXTURE_2D,0);
+		}
+		lru.push_front(entry_t(k,fb,frame));
+		index[k]=lru.begin();
+		return fb;
+	}
+
+private:
+	class entry_t {
+	public:
+		fractal_tile_key key;
+		oglFramebuffer *fb;
+		int last_frame; // frame when this tile was last used
+		entry_t(const fractal_tile_key &k,oglFramebuffer *f,int when)
+			:key(k), fb(f), last_frame(when) {}
+	};
+	typedef std::list<entry_t> lru_t;
+	typedef std::map<fractal_tile_key, lru_t::iterator> index_t;
+	lru_t lru; // front is most recently used
+	index_t index; // finds tiles in lru list
+	int frame;
+};
+
+#endif
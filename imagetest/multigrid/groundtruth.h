@@ -0,0 +1,128 @@
+/**
+  Ground truth for benchmark error evaluation: the source image, box
+  filtered over 16x16 subsamples of each screen pixel (see truth.txt).
+
+  This used to be 256 texture lookups per pixel in the last multigrid
+  pass, every frame.  Now we compute it once per source image and
+  resolution, and the last pass compares against it with one lookup.
+  It's cached next to the image, as raw half-float RGB pixels after a
+  small header, like "../real/ocean.jpg.1024x768.truth".
+  (Public Domain)
+*/
+#ifndef __IMAGETEST_GROUNDTRUTH_H
+#define __IMAGETEST_GROUNDTRUTH_H
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+/* Header of a .truth cache file */
+struct ground_truth_header {
+	char magic[8]; // "truth1"
+	int w,h; // pixels
+	int subsamples; // per pixel, in each direction
+	int pad;
+	long long source_size, source_mtime; // source image file we came from
+};
+
+/** Ground truth image, in a texture. */
+class ground_truth {
+public:
+	GLuint tex; // GL_RGB16F texture, one texel per screen pixel (0 until update)
+	int w,h;
+
+	ground_truth() :tex(0), w(0), h(0) {}
+	~ground_truth() { if (tex) glDeleteTextures(1,&tex); }
+
+	/* Make tex the truth for this source image (loaded into srcTex) at this
+	   screen size, from the cache if we can. */
+	void update(const char *image_,GLuint srcTex,int w_,int h_) {
+		if (tex && image==image_ && w==w_ && h==h_) return; // already have it
+		image=image_; w=w_; h=h_;
+		char name[1024];
+		snprintf(name,sizeof(name),"%s.%dx%d.truth",image_,w,h);
+		std::vector<unsigned short> pixels(3*w*h); // half floats
+		if (!load(name,pixels)) {
+			compute(srcTex,pixels);
+			save(name,pixels);
+		}
+		if (!tex) glGenTextures(1,&tex);
+		glBindTexture(GL_TEXTURE_2D,tex);
+		glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+		glTexImage2D(GL_TEXTURE_2D,0,GL_RGB16F_ARB,w,h,0,GL_RGB,GL_HALF_FLOAT_ARB,&pixels[0]);
+		glPixelStorei(GL_UNPACK_ALIGNMENT,4);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D,0);
+	}
+
+private:
+	enum {subsamples=16}; // must match truth.txt
+	std::string image;
+
+	/* Fill out a header for our current image and size */
+	bool make_header(ground_truth_header &hdr) {
+		struct stat s;
+		if (stat(image.c_str(),&s)!=0) return false;
+		memset(&hdr,0,sizeof(hdr));
+		strcpy(hdr.magic,"truth1");
+		hdr.w=w; hdr.h=h; hdr.subsamples=subsamples;
+		hdr.source_size=s.st_size; hdr.source_mtime=s.st_mtime;
+		return true;
+	}
+
+	/* Read these pixels from this cache file, if it's up to date */
+	bool load(const char *name,std::vector<unsigned short> &pixels) {
+		ground_truth_header want, got;
+		if (!make_header(want)) return false;
+		FILE *f=fopen(name,"rb");
+		if (!f) return false;
+		bool ok=fread(&got,sizeof(got),1,f)==1 && 0==memcmp(&got,&want,sizeof(got))
+			&& fread(&pixels[0],sizeof(pixels[0]),pixels.size(),f)==pixels.size();
+		fclose(f);
+		return ok;
+	}
+
+	void save(const char *name,const std::vector<unsigned short> &pixels) {
+		ground_truth_header hdr;
+		if (!make_header(hdr)) return;
+		FILE *f=fopen(name,"wb");
+		if (!f) { printf("Can't write ground truth cache '%s'\n",name); return; }
+		fwrite(&hdr,sizeof(hdr),1,f);
+		fwrite(&pixels[0],sizeof(pixels[0]),pixels.size(),f);
+		fclose(f);
+	}
+
+	/* Render the truth with truth.txt, and read it back */
+	void compute(GLuint srcTex,std::vector<unsigned short> &pixels) {
+		printf("Computing ground truth for '%s' at %dx%d\n",image.c_str(),w,h);
+		static GLhandleARB prog=makeProgramObjectFromFiles(
+			"interpolate_vtx.txt","truth.txt");
+		GLhandleARB old_prog=glGetHandleARB(GL_PROGRAM_OBJECT_ARB);
+		oglFramebuffer fb(w,h,GL_RGBA16F_ARB);
+		fb.bind();
+		glUseProgramObjectARB(prog);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D,srcTex);
+		glFastUniform1i(prog,"srctex",1);
+		glFastUniform2fv(prog,"pixelSize",1,vec3(1.0/w,1.0/h,0.0));
+		glBegin (GL_QUAD_STRIP);
+		glTexCoord2f(0,0); glVertex3d(-1.0,-1.0,0.0);
+		glTexCoord2f(1,0); glVertex3d(+1.0,-1.0,0.0);
+		glTexCoord2f(0,1); glVertex3d(-1.0,+1.0,0.0);
+		glTexCoord2f(1,1); glVertex3d(+1.0,+1.0,0.0);
+		glEnd();
+		glPixelStorei(GL_PACK_ALIGNMENT,1);
+		glReadPixels(0,0,w,h,GL_RGB,GL_HALF_FLOAT_ARB,&pixels[0]);
+		glPixelStorei(GL_PACK_ALIGNMENT,4);
+		fb.unbind();
+		glActiveTexture(GL_TEXTURE0);
+		glUseProgramObjectARB(old_prog);
+	}
+};
+
+#endif
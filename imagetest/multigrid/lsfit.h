@@ -0,0 +1,201 @@
+/**
+  CPU versions of the least-squares error metrics in interpolate.txt.
+
+  Error metric 400 fits the quadratic A+Bx+Cx^2+Dy+Exy+Gy^2 to the 5x5
+  coarse pixels around each coarse pixel, Gaussian weighted by distance
+  (sigma 1 pixel).  401 then iteratively reweights the fit (IRLS,
+  Huber weights) so a few noisy pixels can't drag it around.  The fit's
+  confidence score is its weighted RMS color residual: small where the
+  neighborhood is smooth (or smooth plus a few outliers, for 401), big
+  across edges.  The refinement test samples where ten times it is over
+  threshold (so thresholds land in the polynomial metrics' 0-2 range),
+  instead of wherever one neighbor misses an interpolating polynomial,
+  which a single noisy pixel is enough to trigger.
+
+  lsfit::reference fits one pixel at a time in double precision with
+  osl::solveLeastSquares.  lsfit::simd fits floats::n pixels of a row
+  at once (SSE or AVX, see osl/floats.h), solving the 6x6 normal
+  equations in every lane together.  "-lscheck" compares both against
+  the GPU's decisions.  The constants here must match interpolate.txt.
+  (Public Domain)
+*/
+#ifndef __IMAGETEST_LSFIT_H
+#define __IMAGETEST_LSFIT_H
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include "osl/floats.h"
+#include "osl/least_squares.h"
+#include "osl/least_squares.cpp"
+#include "osl/matrix.cpp"
+
+/** Least-squares quadratic fits to each pixel's 5x5 neighborhood. */
+class lsfit {
+public:
+	enum {radius=2, side=2*radius+1, points=side*side}; // neighborhood
+	enum {terms=6}; // fit is A, B, C, D, E, G
+	enum {iterations=3}; // IRLS passes, when robust
+	static float sigma(void) {return 1.0f;} // Gaussian weight radius, in pixels
+	static float huber(void) {return 1.345f;} // Huber weight cutoff, in RMS residuals
+	static float min_scale(void) {return 1.0f/255.0f;} // smallest RMS residual for reweighting
+	static float threshold_scale(void) {return 10.0f;} // the refinement test is score*threshold_scale>threshold
+
+	/* Fit this w x h RGB image.  jitter, if any, is where each pixel
+	   sampled, in pixels from its center (2 floats per pixel). */
+	lsfit(int w_,int h_,const float *rgb_,const float *jitter_=0)
+		:w(w_), h(h_), rgb(rgb_), jitter(jitter_) {}
+
+	/**
+	 Fit the neighborhood of pixel (x,y), one pixel at a time, with
+	 osl::solveLeastSquares.  Returns the confidence score, and if fit
+	 is given, writes the terms A,B,C,D,E,G for each of R,G,B there.
+	*/
+	float reference(int x,int y,bool robust,double fit[3][terms]=0) const {
+		double v[points][3], at[points][2], ws[points], wr[points];
+		gather(x,y,v,at,ws);
+		for (int k=0;k<points;k++) wr[k]=1.0;
+		osl::Matrix Wt(terms,points);
+		osl::allocVector b(points);
+		double xSto[3][terms], conf=0.0;
+		for (int pass=0;pass<(robust?iterations:1);pass++) {
+			for (int k=0;k<points;k++) { // rows of Wt, scaled by sqrt(weight)
+				double s=sqrt(ws[k]*wr[k]), px=at[k][0], py=at[k][1];
+				double basis[terms]={1.0,px,px*px,py,px*py,py*py};
+				for (int t=0;t<terms;t++) Wt(t,k)=s*basis[t];
+			}
+			for (int c=0;c<3;c++) {
+				for (int k=0;k<points;k++) b(k)=sqrt(ws[k]*wr[k])*v[k][c];
+				osl::matVector xc(xSto[c],terms);
+				if (!osl::solveLeastSquares(Wt,b,xc)) return 1.0e30f; // can't happen on a 5x5 grid
+			}
+			double res[points], sw=0.0, sr=0.0;
+			for (int k=0;k<points;k++) {
+				double px=at[k][0], py=at[k][1], r2=0.0;
+				for (int c=0;c<3;c++) {
+					const double *p=xSto[c];
+					double d=p[0]+px*(p[1]+px*p[2])+py*(p[3]+px*p[4]+py*p[5])-v[k][c];
+					r2+=d*d;
+				}
+				res[k]=sqrt(r2);
+				sw+=ws[k]*wr[k]; sr+=ws[k]*wr[k]*r2;
+			}
+			conf=sqrt(sr/sw);
+			double scale=std::max(conf,(double)min_scale());
+			for (int k=0;k<points;k++) wr[k]=std::min(1.0,huber()*scale/std::max(res[k],1.0e-6));
+		}
+		if (fit) for (int c=0;c<3;c++) for (int t=0;t<terms;t++) fit[c][t]=xSto[c][t];
+		return (float)conf;
+	}
+
+	/**
+	 Fit every pixel, floats::n at a time.  Writes w*h confidence scores.
+	*/
+	void simd(bool robust,std::vector<float> &conf) const {
+		enum {n=floats::n};
+		conf.resize(w*h);
+		floats ws[points];
+		for (int k=0;k<points;k++) {
+			float ox=k%side-radius, oy=k/side-radius;
+			ws[k]=expf(-0.5f*(ox*ox+oy*oy)/(sigma()*sigma()));
+		}
+		for (int y=0;y<h;y++)
+		for (int x0=0;x0<w;x0+=n) {
+			// Transpose the lanes' neighborhoods into floats
+			floats v[points][3], ax[points], ay[points], wr[points];
+			for (int k=0;k<points;k++) {
+				float lv[3][n], lx[n], ly[n];
+				for (int i=0;i<n;i++) {
+					int x=std::min(x0+i,w-1); // past the end: repeat the last pixel
+					float ox=k%side-radius, oy=k/side-radius;
+					int sx=clampx(x+(int)ox), sy=clampy(y+(int)oy);
+					const float *p=&rgb[3*(sx+sy*w)];
+					for (int c=0;c<3;c++) lv[c][i]=p[c];
+					lx[i]=ox+jitterx(sx,sy)-jitterx(x,y);
+					ly[i]=oy+jittery(sx,sy)-jittery(x,y);
+				}
+				for (int c=0;c<3;c++) v[k][c]=floats(lv[c]);
+				ax[k]=floats(lx); ay[k]=floats(ly);
+				wr[k]=1.0f;
+			}
+
+			floats score=0.0f;
+			for (int pass=0;pass<(robust?iterations:1);pass++) {
+				// Normal equations M p = R, shared by R, G, and B
+				floats M[terms][terms], R[terms][3], p[terms][3];
+				for (int r=0;r<terms;r++) {
+					for (int c=r;c<terms;c++) M[r][c]=0.0f;
+					for (int c=0;c<3;c++) R[r][c]=0.0f;
+				}
+				for (int k=0;k<points;k++) {
+					floats wk=ws[k]*wr[k];
+					floats basis[terms]={1.0f,ax[k],ax[k]*ax[k],ay[k],ax[k]*ay[k],ay[k]*ay[k]};
+					for (int r=0;r<terms;r++) {
+						floats wb=wk*basis[r];
+						for (int c=r;c<terms;c++) M[r][c]+=wb*basis[c];
+						for (int c=0;c<3;c++) R[r][c]+=wb*v[k][c];
+					}
+				}
+				// Symmetric positive definite, so Gaussian elimination needs no pivoting
+				for (int c=0;c<terms;c++) {
+					floats inv=floats(1.0f)/M[c][c];
+					for (int r=c+1;r<terms;r++) {
+						floats f=M[c][r]*inv; // M[r][c], by symmetry
+						for (int k=r;k<terms;k++) M[r][k]-=f*M[c][k];
+						for (int k=0;k<3;k++) R[r][k]-=f*R[c][k];
+					}
+				}
+				for (int r=terms-1;r>=0;r--)
+				for (int c=0;c<3;c++) {
+					floats s=R[r][c];
+					for (int k=r+1;k<terms;k++) s-=M[r][k]*p[k][c];
+					p[r][c]=s/M[r][r];
+				}
+
+				floats res[points], sw=0.0f, sr=0.0f;
+				for (int k=0;k<points;k++) {
+					floats px=ax[k], py=ay[k], r2=0.0f;
+					for (int c=0;c<3;c++) {
+						floats d=p[0][c]+px*(p[1][c]+px*p[2][c])+py*(p[3][c]+px*p[4][c]+py*p[5][c])-v[k][c];
+						r2+=d*d;
+					}
+					res[k]=sqrt(r2);
+					floats wk=ws[k]*wr[k];
+					sw+=wk; sr+=wk*r2;
+				}
+				score=sqrt(sr/sw);
+				floats scale=max(score,min_scale())*huber();
+				for (int k=0;k<points;k++) wr[k]=min(1.0f,scale/max(res[k],1.0e-6f));
+			}
+
+			float out[n];
+			score.store(out);
+			for (int i=0;i<n && x0+i<w;i++) conf[x0+i+y*w]=out[i];
+		}
+	}
+
+private:
+	int w,h;
+	const float *rgb, *jitter;
+
+	int clampx(int x) const {return std::max(0,std::min(w-1,x));}
+	int clampy(int y) const {return std::max(0,std::min(h-1,y));}
+	float jitterx(int x,int y) const {return jitter?jitter[2*(x+y*w)+0]:0.0f;}
+	float jittery(int x,int y) const {return jitter?jitter[2*(x+y*w)+1]:0.0f;}
+
+	/* Values, sample locations (relative to where (x,y) sampled), and
+	   Gaussian weights of (x,y)'s neighborhood.  Off the edge, repeat
+	   the edge pixels, like GL_CLAMP_TO_EDGE. */
+	void gather(int x,int y,double v[points][3],double at[points][2],double ws[points]) const {
+		for (int k=0;k<points;k++) {
+			int ox=k%side-radius, oy=k/side-radius;
+			int sx=clampx(x+ox), sy=clampy(y+oy);
+			for (int c=0;c<3;c++) v[k][c]=rgb[3*(sx+sy*w)+c];
+			at[k][0]=ox+jitterx(sx,sy)-jitterx(x,y);
+			at[k][1]=oy+jittery(sx,sy)-jittery(x,y);
+			ws[k]=exp(-0.5*(ox*ox+oy*oy)/(sigma()*sigma()));
+		}
+	}
+};
+
+#endif
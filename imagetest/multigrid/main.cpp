@@ -8,11 +8,13 @@
 #include <GL/glew.h> /* 
 OpenGL Extensions Wrangler:  for gl...ARB extentions.  Must call glewInit after glutCreateWindow! */
 #include <GL/glut.h> /* OpenGL Utilities Toolkit, for GUI tools */
+#include "ogl/headless.h" /* -headless: render offscreen with EGL */
 #include "ogl/glsl.h"
 #include "ogl/glsl.cpp"
 #include "ogl/minicam.h"
 #include "osl/mat4.h"
 #include "osl/mat4_inverse.h"
+#include "osl/osl_time.h"
 #include "ogl/dumpscreen.h"
 
 #include "ogl/framebuffer.h"
@@ -23,7 +25,14 @@ OpenGL Extensions Wrangler:  for gl...ARB extentions.  Must call glewInit after
 
 const float km=1.0/6371.0; // convert kilometers to render units (planet radii)
 int benchmode=0, dumpmode=0, errormetric=23;
+int multigrid_levels=3; // coarse-to-fine levels, including the full resolution image
+int interpolation=0; // 0 bilinear, 1 nearest, 2 quadratic, 3 biquadratic (see interpolate.txt)
+int placement_mode=0; // where the coarsest level samples: 0 center, 1 jitter, 2 blue noise, 3 importance (see placement.h)
+const char *sweep_file=0; // if nonzero, run a parameter sweep and write results here
+int quality_mode=1; // sweep image quality metrics: 0 for none, 1 on the GPU, 2 on the CPU
 float bench_target=0.0;
+float bench_maxerr=0.0; // sweep: error target to find the cheapest configuration for
+int lsfit_check=0; // -lscheck: redo least-squares error metrics (400 and up) on the CPU, and compare
 double interval_time=1.0; // seconds to show each image
 
 /** SOIL **/
@@ -31,7 +40,7 @@ double interval_time=1.0; // seconds to show each image
 's modifications) */
 #include "soil/SOIL.c" /* just slap in implementation files here, for easier linking */
 #include "soil/stb_image_aug.c"
-void read_soil_jpeg(const char *filename, GLenum mode=GL_RGBA8)
+GLuint read_soil_jpeg(const char *filename, GLenum mode=GL_RGBA8)
 {
 	printf("Reading texture '%s'",filename); fflush(stdout);
 	GLuint srcTex = SOIL_load_OGL_texture
@@ -45,6 +54,7 @@ void read_soil_jpeg(const char *filename, GLenum mode=GL_RGBA8)
 	if (srcTex==0) { printf(" Failed to load image."); exit(1); }
 	printf(".\n");
 	glBindTexture(GL_TEXTURE_2D,srcTex);
+	return srcTex;
 }
 
 
@@ -52,6 +62,8 @@ const char *source_image="../real/ocean.jpg";
 
 
 #include <vector>
+#include "placement.h" /* where the coarsest level samples */
+#include "lsfit.h" /* CPU least-squares fits, for -lscheck */
 
 	static int framecount=0, last_framecount=0;
 	static float last_render=0.0, last_error1=0.0, last_error2=0.0;
@@ -61,7 +73,6 @@ const char *source_image="../real/ocean.jpg";
  Renders an image in steps, from coarse to fine resolution.
  
  FIXME: need to decouple and parameterize several things here
- 	- Multigrid level count
  	- Estimation scheme
  	- Interpolation scheme
  	- Sampling backend (passed in from user)
@@ -70,16 +81,26 @@ class multigrid_renderer {
 public:
 	int wid,ht; // size of full resolution image
 	enum {msaa=0}; // levels of multisample antialiasing: 4^msaa samples per pixel.
-	enum {levels=
-#include "sweep_levels.h"
-+msaa}; // multigrid levels are from 0..levels-1.  level==msaa is the full resolution image
-	oglFramebuffer *fb[levels];
+	int levels; // multigrid levels are from 0..levels-1.  level==msaa is the full resolution image
+	std::vector<oglFramebuffer *> fb;
+	std::vector<oglFramebuffer *> oracle; // per level, one pixel per block (only for error metrics 200 and up)
+	sample_placement placer;
+	int jitter_mode; // placement_mode in jitterTex (or -1 before the first frame)
+	GLuint jitterTex; // per coarsest pixel: where to sample, in its pixels from center
+	std::vector<float> jitterXY; // jitterTex's contents
+	std::vector<float> importance; // per pixel: last frame's error (benchmode), or where the finest level sampled
 	
-	multigrid_renderer(int wid_,int ht_) 
+	multigrid_renderer(int wid_,int ht_,int levels_) 
+		:jitter_mode(-1), jitterTex(0)
 	{
-		wid=wid_; ht=ht_;
-		for (int l=0;l<levels;l++) fb[l]=new oglFramebuffer(
-			(wid<<msaa)>>l,(ht<<msaa)>>l,GL_RGBA8);
+		wid=wid_; ht=ht_; levels=levels_+msaa;
+		for (int l=0;l<levels;l++) fb.push_back(new oglFramebuffer(
+			(wid<<msaa)>>l,(ht<<msaa)>>l,GL_RGBA8));
+		oracle.resize(levels,0);
+	}
+	~multigrid_renderer() {
+		for (int l=0;l<levels;l++) { delete fb[l]; delete oracle[l]; }
+		if (jitterTex) glDeleteTextures(1,&jitterTex);
 	}
 	
 	/** Draw a fullscreen quad (proxy geometry) */
@@ -113,8 +134,12 @@ public:
 			} else if (a<=alphaTest) { // we just rendered this pixel
 				last_render++;
 			}
+			if (placement_mode==sample_placement::importance && w==wid && h==ht) {
+				if (alphaCheck==0.0 && benchmode) importance[x+y*w]=r+g+b;
+				if (alphaCheck>0.0 && !benchmode) importance[x+y*w]=(a<=alphaTest)?1.0f:0.0f;
+			}
 		}
-		printf("%.2f(%d,%d): %.0f	%.0f	%.0f\n", 
+		if (!sweep_file) printf("%.2f(%d,%d): %.0f	%.0f	%.0f\n", 
 			alphaCheck,w,h,
 			last_render,last_error1,last_error2);
 	}
@@ -124,6 +149,129 @@ public:
 		return vec4(fbo->w,fbo->h,1.0/fbo->w,1.0/fbo->h);
 	}
 	
+	/**
+	 Decide where each pixel of the coarsest level samples, and hand that
+	 to prog on texture unit 5.  Importance placement changes every frame.
+	*/
+	void place_samples(GLhandleARB prog) {
+		const oglFramebuffer *c=fb[levels-1];
+		if (placement_mode==sample_placement::importance) importance.resize(wid*ht,0.0f);
+		if (jitter_mode!=placement_mode || placement_mode==sample_placement::importance) {
+			std::vector<float> &xy=jitterXY;
+			placer.place(placement_mode,c->w,c->h,wid,ht,xy,&importance);
+			for (unsigned int i=0;i<xy.size();i++) xy[i]-=0.5f; // relative to center
+			if (!jitterTex) glGenTextures(1,&jitterTex);
+			glBindTexture(GL_TEXTURE_2D,jitterTex);
+			glTexImage2D(GL_TEXTURE_2D,0,GL_LUMINANCE_ALPHA16F_ARB,c->w,c->h,0,
+				GL_LUMINANCE_ALPHA,GL_FLOAT,&xy[0]);
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+			jitter_mode=placement_mode;
+		}
+		glActiveTexture(GL_TEXTURE5);
+		glBindTexture(GL_TEXTURE_2D,jitterTex);
+		glFastUniform1i(prog,"multigridJitterTex",5);
+		glActiveTexture(GL_TEXTURE0);
+	}
+	
+	/**
+	 Frequency-domain error metrics (200 to 211, see oracle.txt): decide
+	 which blocks of coarser level l need samples, and hand that to prog
+	 on texture unit 6.
+	*/
+	void run_oracle(GLhandleARB prog,int l) {
+		static GLhandleARB oprog=makeProgramObjectFromFiles(
+			"interpolate_vtx.txt","oracle.txt");
+		static const float jpeg[64]={ // JPEG luminance quantization table (ITU T.81, Annex K)
+			16, 11, 10, 16, 24, 40, 51, 61,
+			12, 12, 14, 19, 26, 58, 60, 55,
+			14, 13, 16, 24, 40, 57, 69, 56,
+			14, 17, 22, 29, 51, 87, 80, 62,
+			18, 22, 37, 56, 68,109,103, 77,
+			24, 35, 55, 64, 81,104,113, 92,
+			49, 64, 78, 87,103,121,120,101,
+			72, 92, 95, 98,112,100,103, 99};
+		int n=(errormetric%2)?16:8; // block size
+		vec4 info((fb[l]->w+n-1)/n,(fb[l]->h+n-1)/n,n,(errormetric>=210)?1.0:0.0);
+		if (!oracle[l] || oracle[l]->w!=(int)info.x || oracle[l]->h!=(int)info.y) {
+			delete oracle[l];
+			oracle[l]=new oglFramebuffer((int)info.x,(int)info.y,GL_RGBA8);
+		}
+		float threshold=0.0; // same as prog's
+		glGetUniformfvARB(prog,glGetUniformLocationARB(prog,"threshold"),&threshold);
+		
+		oracle[l]->bind();
+		glUseProgramObjectARB(oprog);
+		glActiveTexture(GL_TEXTURE7);
+		glBindTexture(GL_TEXTURE_2D,fb[l]->get_color());
+		glFastUniform1i(oprog,"multigridCoarserTex",7);
+		glFastUniform4fv(oprog,"multigridCoarser",1,framebuffer2vec4(fb[l]));
+		glFastUniform4fv(oprog,"multigridOracle",1,info);
+		glFastUniform1f(oprog,"threshold",threshold);
+		glFastUniform1fv(oprog,"quant",64,jpeg);
+		glBegin (GL_QUAD_STRIP);
+		glTexCoord2f(0,0); glVertex3d(-1.0,-1.0,0.0); 
+		glTexCoord2f(1,0); glVertex3d(+1.0,-1.0,0.0); 
+		glTexCoord2f(0,1); glVertex3d(-1.0,+1.0,0.0); 
+		glTexCoord2f(1,1); glVertex3d(+1.0,+1.0,0.0); 
+		glEnd();
+		oracle[l]->unbind();
+		
+		glUseProgramObjectARB(prog);
+		glActiveTexture(GL_TEXTURE6);
+		glBindTexture(GL_TEXTURE_2D,oracle[l]->get_color());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+		glFastUniform1i(prog,"multigridOracleTex",6);
+		glFastUniform4fv(prog,"multigridOracle",1,info);
+		glActiveTexture(GL_TEXTURE0);
+	}
+	
+	/**
+	 Least-squares error metrics (400 and up): redo the refinement test
+	 from coarser level l+1 to level l on the CPU (see lsfit.h), and
+	 report how the SIMD and reference fits agree with what the GPU did.
+	*/
+	void check_lsfit(GLhandleARB prog,int l) {
+		const oglFramebuffer *c=fb[l+1], *f=fb[l];
+		std::vector<float> rgba(4*c->w*c->h), rgb(3*c->w*c->h);
+		glBindTexture(GL_TEXTURE_2D,c->get_color());
+		glGetTexImage(GL_TEXTURE_2D,0,GL_RGBA,GL_FLOAT,&rgba[0]);
+		glBindTexture(GL_TEXTURE_2D,0);
+		for (int i=0;i<c->w*c->h;i++) for (int k=0;k<3;k++) rgb[3*i+k]=rgba[4*i+k];
+		std::vector<unsigned char> fine(4*f->w*f->h); // level l, just rendered
+		glReadPixels(0,0,f->w,f->h,GL_RGBA,GL_UNSIGNED_BYTE,&fine[0]);
+		float threshold=0.0, coarsest=0.0; // same as prog's
+		glGetUniformfvARB(prog,glGetUniformLocationARB(prog,"threshold"),&threshold);
+		glGetUniformfvARB(prog,glGetUniformLocationARB(prog,"multigridCoarsest"),&coarsest);
+		
+		bool jittered=(l==levels-2 && placement_mode!=sample_placement::center);
+		lsfit fit(c->w,c->h,&rgb[0],jittered?&jitterXY[0]:0);
+		bool robust=(errormetric>=401);
+		std::vector<float> conf;
+		double start=oslTime();
+		fit.simd(robust,conf);
+		double simd=oslTime()-start;
+		start=oslTime();
+		float worst=0.0;
+		for (int y=0;y<c->h;y++) for (int x=0;x<c->w;x++)
+			worst=std::max(worst,fabsf(fit.reference(x,y,robust)-conf[x+y*c->w]));
+		double reference=oslTime()-start;
+		
+		int differ=0, alphaTest=(int)ceil(coarsest*255.0)+1;
+		for (int y=0;y<f->h;y++) for (int x=0;x<f->w;x++) {
+			int cx=(int)((x+0.5)*c->w/f->w), cy=(int)((y+0.5)*c->h/f->h);
+			bool gpu=fine[4*(x+y*f->w)+3]<=alphaTest; // sampled this level
+			bool cpu=conf[cx+cy*c->w]*lsfit::threshold_scale()>threshold;
+			if (gpu!=cpu) differ++;
+		}
+		printf("lsfit level %d: SIMD %.2f ms, reference %.2f ms, max confidence difference %.2g; "
+			"CPU and GPU disagree on %d of %d pixels\n",
+			l,1000.0*simd,1000.0*reference,worst,differ,f->w*f->h);
+	}
+	
 	/**
 	 Loop over multigrid levels and do rendering.
 	 FIXME: inputs & sampling part of shader should be parameterized
@@ -131,14 +279,22 @@ public:
 	void render(GLhandleARB prog) {
 		glFastUniform1f(prog,"benchmode",(float)benchmode);
 		glFastUniform1f(prog,"errormetric",(float)errormetric);
+		glFastUniform1f(prog,"interpolation",(float)interpolation);
 		
 		last_render=0.0; last_error1=0.0; last_error2=0.0;
+		place_samples(prog);
+		vec4 jitter(1.0/fb[levels-1]->w,1.0/fb[levels-1]->h,
+			placement_mode==sample_placement::center?0.0:1.0,0.0);
+		glFastUniform4fv(prog,"multigridJitter",1,jitter);
 		glFastUniform1f(prog,"multigridCoarsest",1.0f);
 		fb[levels-1]->bind();
 		screen_quad(1.0f);
 		for (int l=levels-2;l>=-1;l--) {
 			float multigridCoarsest=(l+1)*1.0/(levels);
 			glFastUniform1f(prog,"multigridCoarsest",multigridCoarsest);
+			if (errormetric>=200 && errormetric<300 && l>=0) run_oracle(prog,l+1);
+			jitter.w=(l==levels-2)?1.0:0.0; // only the coarsest level's samples move
+			glFastUniform4fv(prog,"multigridJitter",1,jitter);
 			if (l==-1) fb[levels-1]->unbind(); // last step: render to screen
 			else fb[l]->bind(); // intermediate step: render to framebuffer
 			
@@ -159,6 +315,7 @@ public:
 			else glFastUniform4fv(prog,"multigridFiner", 1, framebuffer2vec4(fb[msaa]) );
 			
 			screen_quad(multigridCoarsest);
+			if (lsfit_check && errormetric>=400 && l>=0) check_lsfit(prog,l);
 		}
 		
 		glBindTexture(GL_TEXTURE_2D,0); // clear texture state
@@ -168,6 +325,36 @@ public:
 
 multigrid_renderer *renderer=0;
 
+#include "groundtruth.h" /* box-filtered source image, for measuring error */
+ground_truth truth;
+
+/* Set up the source image texture, on texture unit 1 */
+void bind_source_image(GLhandleARB prog,GLuint srcTex) {
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D,srcTex);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAX_ANISOTROPY_EXT,4);
+	//glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+	glFastUniform1i(prog,"srctex",1); // texture unit number
+	GLenum target=GL_TEXTURE_2D;
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER,GL_LINEAR); // _MIPMAP_LINEAR);
+	GLenum texWrap=GL_CLAMP_TO_EDGE;
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, texWrap); 
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, texWrap);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+/* Set up the ground truth for this source image, on texture unit 2 */
+void bind_ground_truth(GLhandleARB prog,const char *image,GLuint srcTex,int wid,int ht) {
+	truth.update(image,srcTex,wid,ht);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D,truth.tex);
+	glFastUniform1i(prog,"truthtex",2);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+#include "sweep.h" /* -sweep: metrics x levels x thresholds, in one process */
+
 void display(void) 
 {
 	glDisable(GL_DEPTH_TEST);
@@ -185,7 +372,7 @@ void display(void)
 	int wid=glutGet(GLUT_WINDOW_WIDTH), ht=glutGet(GLUT_WINDOW_HEIGHT);
 	if (!renderer || renderer->wid!=wid || renderer->ht!=ht) {
 		delete renderer;
-		renderer=new multigrid_renderer(wid,ht);
+		renderer=new multigrid_renderer(wid,ht,multigrid_levels);
 	}
 	
 	glMatrixMode(GL_PROJECTION);
@@ -203,22 +390,19 @@ void display(void)
 	static float threshold=2.0;
 	glFastUniform1f(prog,"threshold",threshold);
 	
+	if (sweep_file) { // whole sweep happens in here
+		sweep_run(prog,wid,ht);
+		exit(0);
+	}
 	
-	static bool read_imgs=true; /* only read textures on the first frame */
-/* Upload planet texture, to texture unit 1 */
-	glActiveTexture(GL_TEXTURE1);
-	if (read_imgs) read_soil_jpeg(source_image,GL_RGBA8);
-	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAX_ANISOTROPY_EXT,4);
-	//glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
-	glFastUniform1i(prog,"srctex",1); // texture unit number
-	GLenum target=GL_TEXTURE_2D;
-	glTexParameteri(target, GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-	glTexParameteri(target, GL_TEXTURE_MIN_FILTER,GL_LINEAR); // _MIPMAP_LINEAR);
-	GLenum texWrap=GL_CLAMP_TO_EDGE;
-	glTexParameteri(target, GL_TEXTURE_WRAP_S, texWrap); 
-	glTexParameteri(target, GL_TEXTURE_WRAP_T, texWrap);
-	read_imgs=false;
-	glActiveTexture(GL_TEXTURE0);
+/* Upload source image texture (only on the first frame), to texture unit 1 */
+	static GLuint srcTex=0;
+	if (!srcTex) {
+		glActiveTexture(GL_TEXTURE1);
+		srcTex=read_soil_jpeg(source_image,GL_RGBA8);
+	}
+	bind_source_image(prog,srcTex);
+	if (benchmode) bind_ground_truth(prog,source_image,srcTex,wid,ht);
 	
 	
 	renderer->render(prog);
@@ -348,8 +532,32 @@ int main(int argc,char *argv[])
 	for (int argi=1;argi<argc;argi++) {
 		if (0==strcmp(argv[argi],"-bench")) { benchmode=1; interval_time=0.01; }
 		else if (0==strcmp(argv[argi],"-target")) { benchmode=2; bench_target=atof(argv[++argi]); }
-		else if (0==strcmp(argv[argi],"-metric")) { errormetric=atoi(argv[++argi]); }
-		else if (0==strcmp(argv[argi],"-img")) { source_image=argv[++argi]; }
+		else if (0==strcmp(argv[argi],"-metric")) { // e.g., -metric 23 or -metric 20,21,22,23
+			sweep_metrics=sweep_parse_list(argv[++argi]);
+			errormetric=(int)sweep_metrics[0];
+		}
+		else if (0==strcmp(argv[argi],"-levels")) { // e.g., -levels 3 or -levels 2,3,4,5,6
+			sweep_levels=sweep_parse_list(argv[++argi]);
+			multigrid_levels=(int)sweep_levels[0];
+		}
+		else if (0==strcmp(argv[argi],"-interp")) { // e.g., -interp 0 or -interp 0,1,2,3
+			sweep_interps=sweep_parse_list(argv[++argi]);
+			interpolation=(int)sweep_interps[0];
+		}
+		else if (0==strcmp(argv[argi],"-placement")) { // e.g., -placement 2 or -placement 0,1,2,3
+			sweep_placements=sweep_parse_list(argv[++argi]);
+			placement_mode=(int)sweep_placements[0];
+		}
+		else if (0==strcmp(argv[argi],"-thresholds")) { sweep_thresholds=sweep_parse_list(argv[++argi]); }
+		else if (0==strcmp(argv[argi],"-rates")) { sweep_rates=sweep_parse_list(argv[++argi]); }
+		else if (0==strcmp(argv[argi],"-maxerr")) { bench_maxerr=atof(argv[++argi]); }
+		else if (0==strcmp(argv[argi],"-sweep")) { sweep_file=argv[++argi]; }
+		else if (0==strcmp(argv[argi],"-lscheck")) { lsfit_check=1; }
+		else if (0==strcmp(argv[argi],"-quality")) { // gpu, cpu, or off
+			argi++;
+			quality_mode=(0==strcmp(argv[argi],"gpu"))?1:(0==strcmp(argv[argi],"cpu"))?2:0;
+		}
+		else if (0==strcmp(argv[argi],"-img")) { source_image=argv[++argi]; sweep_images.push_back(source_image); }
 		else if (0==strcmp(argv[argi],"-pixelbench")) benchmode=2;
 		else if (2==sscanf(argv[argi],"%dx%d",&w,&h)) {}
 		else printf("Unrecognized argument '%s'!\n",argv[argi]);
@@ -0,0 +1,28 @@
+#!/bin/sh
+# Plot the rate-distortion curves and Pareto front from "./main -sweep sweep.txt"
+#   Usage: ./pareto_plot.sh [ sweep.txt ]
+s="${1:-sweep.txt}"
+
+gp='
+set nologscale
+set key right top
+set xlabel "Samples Per Finished Pixel"
+set ylabel "Average Absolute Color Error (%)"
+set yrange [0.0:*] # errors vary a lot by image set: fit the top to the data
+set xrange [0:1]
+
+set term postscript eps color 22
+set output "pareto_plot.eps"
+
+plot '
+sep=""
+n=`grep -c "^# levels" "$s.curves"`
+i=0
+while [ $i -lt $n ]
+do
+	gp="$gp $sep  \"$s.curves\" index $i using 2:(100*\$3) notitle with lines lt 0"
+	sep=","
+	i=`expr $i + 1`
+done
+gp="$gp $sep  \"$s.pareto\" using 1:(100*\$2) title \"Pareto front\" with linespoints lw 3"
+echo "$gp" | gnuplot
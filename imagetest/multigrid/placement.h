@@ -0,0 +1,123 @@
+/**
+  Sample placement: where to take the one sample in each cell of a
+  grid, like each pixel of the coarsest multigrid level (which used to
+  always sample at the cell center, and so systematically missed
+  features like the squares of synthetic/checker.jpg), or each cell of
+  a scattered.h sample grid.
+
+  	center: the middle of the cell, as before.
+  	jitter: stratified random, uniform within the cell.
+  	bluenoise: one point per cell, spread out from its neighbors: we
+  		precompute a 32x32 cell tile by best-candidate sampling (with
+  		wraparound, so it tiles), and repeat it across the grid.
+  	importance: the pixel in the cell drawn in proportion to an
+  		importance map, like the previous frame's error, using the
+  		blue noise tile as the random numbers.  Cells with no
+  		importance fall back to blue noise.
+
+  Everything is seeded, so the same seed gives the same samples.
+  (Public Domain)
+*/
+#ifndef __IMAGETEST_PLACEMENT_H
+#define __IMAGETEST_PLACEMENT_H
+
+#include <vector>
+#include <algorithm>
+#include "osl/random.h"
+#include "osl/random.cpp"
+
+/** Picks one sample location in each cell of a grid. */
+class sample_placement {
+public:
+	enum {center=0, jitter=1, bluenoise=2, importance=3};
+	enum {tile=32}; // blue noise tile size, in cells
+
+	sample_placement(int seed_=1) :seed(seed_) {}
+
+	/**
+	 Find the sample location in each of cw x ch cells covering a w x h
+	 pixel image: cell (i,j) is pixels w*i/cw to w*(i+1)/cw, and likewise
+	 in y.  Writes xy[2*(i+j*cw)+0 and 1], as fractions of the cell in [0,1).
+	 The importance map, if any, is w x h floats.
+	*/
+	void place(int mode,int cw,int ch,int w,int h,std::vector<float> &xy,
+		const std::vector<float> *weights=0)
+	{
+		xy.resize(2*cw*ch);
+		osl::Random48 rng(seed);
+		if (mode!=center && mode!=jitter) make_tile();
+		for (int j=0;j<ch;j++)
+		for (int i=0;i<cw;i++) {
+			float *p=&xy[2*(i+j*cw)];
+			if (mode==center) { p[0]=p[1]=0.5f; continue; }
+			if (mode==jitter) { p[0]=rng.nextFloat(); p[1]=rng.nextFloat(); continue; }
+			const float *b=&blue[2*((i%tile)+(j%tile)*tile)];
+			p[0]=b[0]; p[1]=b[1];
+			if (mode==importance && weights && (int)weights->size()==w*h)
+				importance_pixel(*weights,w,w*i/cw,w*(i+1)/cw,h*j/ch,h*(j+1)/ch,p);
+		}
+	}
+
+private:
+	int seed;
+	std::vector<float> blue; // tile x tile cells of (x,y) within the cell
+
+	/* Best-candidate blue noise, one point per cell, wrapping around the tile */
+	void make_tile(void) {
+		if (blue.size()) return;
+		const int candidates=16;
+		osl::Random48 rng(seed);
+		blue.assign(2*tile*tile,-1.0f);
+		std::vector<int> order(tile*tile);
+		for (int c=0;c<tile*tile;c++) order[c]=c;
+		for (int c=tile*tile-1;c>0;c--) std::swap(order[c],order[rng.nextInt(c+1)]);
+		for (int k=0;k<tile*tile;k++) {
+			int c=order[k], ci=c%tile, cj=c/tile;
+			float bestD=-1.0f, bx=0.5f, by=0.5f;
+			for (int n=0;n<candidates;n++) {
+				float x=rng.nextFloat(), y=rng.nextFloat();
+				float d=1.0e30f; // squared distance to the closest point so far, in cells
+				for (int dj=-2;dj<=2;dj++)
+				for (int di=-2;di<=2;di++) {
+					int oi=(ci+di+tile)%tile, oj=(cj+dj+tile)%tile;
+					const float *o=&blue[2*(oi+oj*tile)];
+					if (o[0]<0.0f) continue; // not placed yet
+					float dx=di+o[0]-x, dy=dj+o[1]-y;
+					d=std::min(d,dx*dx+dy*dy);
+				}
+				if (d>bestD) { bestD=d; bx=x; by=y; }
+			}
+			blue[2*c+0]=bx; blue[2*c+1]=by;
+		}
+	}
+
+	/* Replace p's blue noise numbers with a pixel in x0..x1 by y0..y1,
+	   drawn in proportion to its importance */
+	void importance_pixel(const std::vector<float> &weights,int w,
+		int x0,int x1,int y0,int y1,float *p)
+	{
+		float total=0.0f;
+		for (int y=y0;y<y1;y++) for (int x=x0;x<x1;x++) total+=weights[x+y*w];
+		if (total<=0.0f) return; // nothing important here: keep blue noise
+		float u=p[1]*total; // pick a row, by its total importance
+		int y=y0;
+		for (;y<y1-1;y++) {
+			float row=0.0f;
+			for (int x=x0;x<x1;x++) row+=weights[x+y*w];
+			if (u<row) break;
+			u-=row;
+		}
+		float rowTotal=0.0f;
+		for (int x=x0;x<x1;x++) rowTotal+=weights[x+y*w];
+		float v=p[0]*rowTotal; // then a pixel in that row
+		int x=x0;
+		for (;x<x1-1;x++) {
+			if (v<weights[x+y*w]) break;
+			v-=weights[x+y*w];
+		}
+		p[0]=(x+0.5f-x0)/(x1-x0);
+		p[1]=(y+0.5f-y0)/(y1-y0);
+	}
+};
+
+#endif
@@ -0,0 +1,297 @@
+/**
+  Image quality metrics for benchmarks: PSNR, SSIM, and multi-scale SSIM,
+  comparing a rendered image against the ground truth (groundtruth.h).
+
+  SSIM uses luma over an 11x11 Gaussian window (sigma 1.5), as in Wang
+  et al. 2004; MS-SSIM uses five scales with the weights from Wang,
+  Simoncelli, and Bovik 2003.  The scales are the multigrid level sizes
+  (w>>l by h>>l), and scale 0 is read straight from the multigrid
+  renderer's finest level, fb[0].
+
+  There's a GPU version (ssim.txt, plus downsample.txt's box filter),
+  and a CPU version that splits rows across threads.  Both clamp the
+  SSIM window at the image edges, and they agree to within float
+  rounding.
+  (Public Domain)
+*/
+#ifndef __IMAGETEST_QUALITY_H
+#define __IMAGETEST_QUALITY_H
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include "osl/porthread.h"
+#include "osl/porthread.cpp"
+
+/** Quality of one image, compared to the truth */
+struct image_quality {
+	double psnr; // peak signal to noise ratio, in dB (capped at 100)
+	double ssim; // structural similarity, 1.0 for a perfect match
+	double msssim; // multi-scale SSIM
+};
+
+/** Measures image quality against ground truth, on the GPU or CPU. */
+class quality_meter {
+public:
+	quality_meter(int threads_=4) :threads(threads_), w(0), h(0) {}
+	~quality_meter() { resize(0,0); }
+
+	/* Compare these w x h RGB textures, on the GPU */
+	image_quality gpu(GLuint image,GLuint truth,int w_,int h_) {
+		resize(w_,h_);
+		GLhandleARB old_prog=glGetHandleARB(GL_PROGRAM_OBJECT_ARB);
+		double sums[scales][4];
+		for (int s=0;s<scales;s++) {
+			GLuint img=image, tru=truth;
+			if (s>0) {
+				downsample(s==1?image:fbImage[s-1]->get_color(),fbImage[s]);
+				downsample(s==1?truth:fbTruth[s-1]->get_color(),fbTruth[s]);
+				img=fbImage[s]->get_color(); tru=fbTruth[s]->get_color();
+			}
+			terms(img,tru,fbTerms[s],sums[s]);
+		}
+		glUseProgramObjectARB(old_prog);
+
+		double mean[scales][4];
+		for (int s=0;s<scales;s++) for (int i=0;i<4;i++)
+			mean[s][i]=sums[s][i]/((w>>s)*(h>>s));
+		return combine(mean);
+	}
+
+	/* Compare these w x h RGB textures, on the CPU */
+	image_quality cpu(GLuint image,GLuint truth,int w_,int h_) {
+		resize(w_,h_);
+		std::vector<float> rgbA, rgbB;
+		read_texture(image,rgbA);
+		read_texture(truth,rgbB);
+
+		cpu_scale sc; // current scale
+		sc.w=w; sc.h=h;
+		sc.A.resize(w*h); sc.B.resize(w*h);
+		double sqerr=0.0;
+		for (int i=0;i<w*h;i++) {
+			sc.A[i]=luma(&rgbA[3*i]); sc.B[i]=luma(&rgbB[3*i]);
+			for (int c=0;c<3;c++) { double d=rgbA[3*i+c]-rgbB[3*i+c]; sqerr+=d*d; }
+		}
+
+		double mean[scales][4];
+		for (int s=0;s<scales;s++) {
+			if (s>0) { // 2x2 box filter both images down to w>>s by h>>s
+				int nw=w>>s, nh=h>>s;
+				std::vector<float> A(nw*nh), B(nw*nh);
+				for (int y=0;y<nh;y++) for (int x=0;x<nw;x++) {
+					int i=2*x+2*y*sc.w;
+					A[x+y*nw]=0.25f*(sc.A[i]+sc.A[i+1]+sc.A[i+sc.w]+sc.A[i+sc.w+1]);
+					B[x+y*nw]=0.25f*(sc.B[i]+sc.B[i+1]+sc.B[i+sc.w]+sc.B[i+sc.w+1]);
+				}
+				sc.A.swap(A); sc.B.swap(B); sc.w=nw; sc.h=nh;
+			}
+			cpu_terms(sc,mean[s]);
+		}
+		mean[0][3]=sqerr/(3.0*w*h);
+		return combine(mean);
+	}
+
+private:
+	enum {scales=5};
+	int threads;
+	int w,h; // size of scale 0
+	std::vector<oglFramebuffer *> fbImage, fbTruth, fbTerms; // per scale
+
+	/* Make our framebuffers for this image size */
+	void resize(int w_,int h_) {
+		if (w==w_ && h==h_) return;
+		for (unsigned int s=0;s<fbTerms.size();s++) {
+			delete fbImage[s]; delete fbTruth[s]; delete fbTerms[s];
+		}
+		fbImage.clear(); fbTruth.clear(); fbTerms.clear();
+		w=w_; h=h_;
+		if (w==0) return;
+		for (int s=0;s<scales;s++) {
+			fbImage.push_back(s==0?0:new oglFramebuffer(w>>s,h>>s,GL_RGBA16F_ARB));
+			fbTruth.push_back(s==0?0:new oglFramebuffer(w>>s,h>>s,GL_RGBA16F_ARB));
+			fbTerms.push_back(new oglFramebuffer(w>>s,h>>s,GL_RGBA32F_ARB));
+			if (s>0) { clamp(fbImage[s]->get_color()); clamp(fbTruth[s]->get_color()); }
+		}
+	}
+
+	/* Make texture tex clamp at its edges, like the CPU version's windows */
+	static void clamp(GLuint tex) {
+		glBindTexture(GL_TEXTURE_2D,tex);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D,0);
+	}
+
+	/* Draw a fullscreen quad */
+	static void quad(void) {
+		glBegin (GL_QUAD_STRIP);
+		glTexCoord2f(0,0); glVertex3d(-1.0,-1.0,0.0);
+		glTexCoord2f(1,0); glVertex3d(+1.0,-1.0,0.0);
+		glTexCoord2f(0,1); glVertex3d(-1.0,+1.0,0.0);
+		glTexCoord2f(1,1); glVertex3d(+1.0,+1.0,0.0);
+		glEnd();
+	}
+
+	/* Average 2x2 texels of src into each pixel of dest, with downsample.txt */
+	void downsample(GLuint src,oglFramebuffer *dest) {
+		static GLhandleARB prog=makeProgramObjectFromFiles(
+			"interpolate_vtx.txt","downsample.txt");
+		dest->bind();
+		glUseProgramObjectARB(prog);
+		glActiveTexture(GL_TEXTURE3);
+		glBindTexture(GL_TEXTURE_2D,src);
+		GLint mag,min;
+		glGetTexParameteriv(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,&mag);
+		glGetTexParameteriv(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,&min);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+		glFastUniform1i(prog,"src",3);
+		glFastUniform2fv(prog,"pixelSize",1,vec3(1.0/dest->w,1.0/dest->h,0.0));
+		quad();
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,mag);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,min);
+		glBindTexture(GL_TEXTURE_2D,0);
+		glActiveTexture(GL_TEXTURE0);
+		dest->unbind();
+	}
+
+	/* Run ssim.txt on these textures into dest, and sum up its four channels */
+	void terms(GLuint image,GLuint truth,oglFramebuffer *dest,double sums[4]) {
+		static GLhandleARB prog=makeProgramObjectFromFiles(
+			"interpolate_vtx.txt","ssim.txt");
+		dest->bind();
+		glUseProgramObjectARB(prog);
+		GLint wrap[2][2]; // scale 0 is the caller's textures: clamp them just for now
+		glActiveTexture(GL_TEXTURE3); glBindTexture(GL_TEXTURE_2D,image);
+		clamp_bound(wrap[0]);
+		glActiveTexture(GL_TEXTURE4); glBindTexture(GL_TEXTURE_2D,truth);
+		clamp_bound(wrap[1]);
+		glFastUniform1i(prog,"image",3);
+		glFastUniform1i(prog,"truth",4);
+		glFastUniform2fv(prog,"pixelSize",1,vec3(1.0/dest->w,1.0/dest->h,0.0));
+		quad();
+		restore_bound(wrap[1]);
+		glBindTexture(GL_TEXTURE_2D,0);
+		glActiveTexture(GL_TEXTURE3);
+		restore_bound(wrap[0]);
+		glBindTexture(GL_TEXTURE_2D,0);
+		glActiveTexture(GL_TEXTURE0);
+
+		std::vector<float> px(4*dest->w*dest->h);
+		glReadPixels(0,0,dest->w,dest->h,GL_RGBA,GL_FLOAT,&px[0]);
+		dest->unbind();
+		for (int i=0;i<4;i++) sums[i]=0.0;
+		for (unsigned int p=0;p<px.size();p+=4)
+			for (int i=0;i<4;i++) sums[i]+=px[p+i];
+	}
+
+	/* Clamp the bound texture at its edges, saving its old wrap modes */
+	static void clamp_bound(GLint wrap[2]) {
+		glGetTexParameteriv(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,&wrap[0]);
+		glGetTexParameteriv(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,&wrap[1]);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+	}
+	static void restore_bound(const GLint wrap[2]) {
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,wrap[0]);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,wrap[1]);
+	}
+
+	/* Combine per-scale means of (ssim, cs, l, squared error) into our metrics */
+	static image_quality combine(const double mean[scales][4]) {
+		static const double weight[scales]={0.0448,0.2856,0.3001,0.2363,0.1333};
+		image_quality q;
+		q.psnr=10.0*log10(1.0/std::max(mean[0][3],1.0e-10));
+		q.ssim=mean[0][0];
+		q.msssim=pow(std::max(mean[scales-1][2],0.0),weight[scales-1]);
+		for (int s=0;s<scales;s++) q.msssim*=pow(std::max(mean[s][1],0.0),weight[s]);
+		return q;
+	}
+
+	static float luma(const float *rgb) { return 0.299f*rgb[0]+0.587f*rgb[1]+0.114f*rgb[2]; }
+
+	void read_texture(GLuint tex,std::vector<float> &rgb) {
+		rgb.resize(3*w*h);
+		glBindTexture(GL_TEXTURE_2D,tex);
+		glGetTexImage(GL_TEXTURE_2D,0,GL_RGB,GL_FLOAT,&rgb[0]);
+		glBindTexture(GL_TEXTURE_2D,0);
+	}
+
+	/* One scale of the CPU version: luma planes, and the Gaussian sums */
+	struct cpu_scale {
+		int w,h;
+		std::vector<float> A,B; // luma of image and truth
+		std::vector<float> H[5]; // rows blurred: A, B, AA, BB, AB
+		std::vector<double> sums; // per thread: ssim, cs, l
+		int pass; // 0: blur rows; 1: blur columns and sum terms
+	};
+	struct cpu_job {
+		cpu_scale *sc;
+		int thread, y0, y1;
+	};
+
+	/* Compute the means of (ssim, cs, l) for this scale, in parallel */
+	void cpu_terms(cpu_scale &sc,double mean[4]) {
+		for (int i=0;i<5;i++) sc.H[i].resize(sc.w*sc.h);
+		sc.sums.assign(3*threads,0.0);
+		for (sc.pass=0;sc.pass<2;sc.pass++) {
+			std::vector<cpu_job> jobs(threads);
+			std::vector<porthread_t> t(threads);
+			for (int i=0;i<threads;i++) {
+				jobs[i].sc=&sc; jobs[i].thread=i;
+				jobs[i].y0=sc.h*i/threads; jobs[i].y1=sc.h*(i+1)/threads;
+				if (i>0) t[i]=porthread_create(cpu_worker,&jobs[i]);
+			}
+			cpu_worker(&jobs[0]); // we do some too
+			for (int i=1;i<threads;i++) porthread_wait(t[i]);
+		}
+		for (int i=0;i<3;i++) {
+			mean[i]=0.0;
+			for (int th=0;th<threads;th++) mean[i]+=sc.sums[3*th+i];
+			mean[i]/=sc.w*sc.h;
+		}
+		mean[3]=0.0;
+	}
+
+	static void cpu_worker(void *arg) {
+		cpu_job *j=(cpu_job *)arg;
+		cpu_scale &sc=*j->sc;
+		float g[11], sumG=0.0f; // normalized 1D Gaussian
+		for (int k=0;k<11;k++) { g[k]=exp(-(k-5)*(k-5)/(2.0*1.5*1.5)); sumG+=g[k]; }
+		for (int k=0;k<11;k++) g[k]/=sumG;
+		const float C1=0.01f*0.01f, C2=0.03f*0.03f;
+		int w=sc.w, h=sc.h;
+		double ssim=0.0, cs=0.0, l=0.0;
+		for (int y=j->y0;y<j->y1;y++)
+		for (int x=0;x<w;x++) {
+			float s[5]={0,0,0,0,0};
+			if (sc.pass==0) { // blur along rows, clamping at the edges
+				for (int k=0;k<11;k++) {
+					int i=std::min(std::max(x+k-5,0),w-1)+y*w;
+					float a=sc.A[i], b=sc.B[i];
+					s[0]+=g[k]*a; s[1]+=g[k]*b;
+					s[2]+=g[k]*a*a; s[3]+=g[k]*b*b; s[4]+=g[k]*a*b;
+				}
+				for (int c=0;c<5;c++) sc.H[c][x+y*w]=s[c];
+			} else { // blur along columns, and evaluate SSIM
+				for (int k=0;k<11;k++) {
+					int i=x+std::min(std::max(y+k-5,0),h-1)*w;
+					for (int c=0;c<5;c++) s[c]+=g[k]*sc.H[c][i];
+				}
+				float muA=s[0], muB=s[1];
+				float varA=s[2]-muA*muA, varB=s[3]-muB*muB, covAB=s[4]-muA*muB;
+				float pl=(2.0f*muA*muB+C1)/(muA*muA+muB*muB+C1);
+				float pcs=(2.0f*covAB+C2)/(varA+varB+C2);
+				ssim+=pl*pcs; cs+=pcs; l+=pl;
+			}
+		}
+		if (sc.pass==1) {
+			sc.sums[3*j->thread+0]=ssim;
+			sc.sums[3*j->thread+1]=cs;
+			sc.sums[3*j->thread+2]=l;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,195 @@
+/**
+  Scattered-sample reconstruction, to compare sparse non-grid sampling
+  against the multigrid pyramid at equal sample counts.
+
+  We pick one pixel to sample in each cell of a grid (see placement.h
+  for where in the cell), triangulate them with osl/delaunay,
+  and fill in every other pixel by barycentric interpolation across
+  its triangle, splitting the image rows across threads.  The four
+  corner pixels are always sampled, so the triangles cover the image.
+
+  In a sweep, error metrics 300, 301, 302, and 303 are center, jitter,
+  blue noise, and importance placement; their "threshold" is the sample
+  rate asked for, from -rates.  Importance comes from the error of the
+  last reconstruction, so each rate draws its samples toward where the
+  previous rate went wrong.  Samples are the source image at screen
+  resolution, like sample() in interpolate.txt.
+  (Public Domain)
+*/
+#ifndef __IMAGETEST_SCATTERED_H
+#define __IMAGETEST_SCATTERED_H
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include "osl/delaunay.h"
+#include "osl/delaunay.cpp"
+#include "placement.h"
+#include "osl/porthread.h" /* implementation comes with quality.h */
+
+/** Reconstructs images from samples at scattered pixels. */
+class scattered_renderer {
+public:
+	int w,h;
+	std::vector<int> samples; // sampled pixels, as x+y*w
+	std::vector<float> importance; // per pixel error of our last reconstruction
+	std::vector<unsigned char> image; // RGBA reconstruction
+	GLuint tex; // image, uploaded (for quality_meter)
+
+	scattered_renderer(int threads_=4) :w(0), h(0), tex(0), threads(threads_) {}
+	~scattered_renderer() { if (tex) glDeleteTextures(1,&tex); }
+
+	/* Read back this source image (as sampled at w x h) and its ground truth */
+	void set_image(GLuint srcTex,GLuint truthTex,int w_,int h_) {
+		w=w_; h=h_;
+		GLhandleARB old_prog=glGetHandleARB(GL_PROGRAM_OBJECT_ARB);
+		oglFramebuffer fb(w,h,GL_RGBA8);
+		fb.bind();
+		glUseProgramObjectARB(0);
+		glActiveTexture(GL_TEXTURE0);
+		glEnable(GL_TEXTURE_2D);
+		glBindTexture(GL_TEXTURE_2D,srcTex);
+		glTexEnvi(GL_TEXTURE_ENV,GL_TEXTURE_ENV_MODE,GL_REPLACE);
+		glBegin (GL_QUAD_STRIP);
+		glTexCoord2f(0,0); glVertex3d(-1.0,-1.0,0.0);
+		glTexCoord2f(1,0); glVertex3d(+1.0,-1.0,0.0);
+		glTexCoord2f(0,1); glVertex3d(-1.0,+1.0,0.0);
+		glTexCoord2f(1,1); glVertex3d(+1.0,+1.0,0.0);
+		glEnd();
+		glBindTexture(GL_TEXTURE_2D,0);
+		glDisable(GL_TEXTURE_2D);
+		source.resize(4*w*h);
+		glReadPixels(0,0,w,h,GL_RGBA,GL_UNSIGNED_BYTE,&source[0]);
+		fb.unbind();
+		glUseProgramObjectARB(old_prog);
+
+		truth.resize(3*w*h);
+		glBindTexture(GL_TEXTURE_2D,truthTex);
+		glGetTexImage(GL_TEXTURE_2D,0,GL_RGB,GL_FLOAT,&truth[0]);
+		glBindTexture(GL_TEXTURE_2D,0);
+	}
+
+	/* Pick about rate*w*h pixels to sample, one per grid cell, placed
+	   within the cell by this sample_placement mode */
+	void place(int mode,double rate) {
+		samples.clear();
+		int n=std::max(4,(int)(rate*w*h));
+		double cell=sqrt(w*h/(double)n);
+		int cw=std::max(1,(int)(w/cell+0.5)), ch=std::max(1,(int)(h/cell+0.5));
+		std::vector<float> xy;
+		placer.place(mode,cw,ch,w,h,xy,&importance);
+		for (int j=0;j<ch;j++)
+		for (int i=0;i<cw;i++) {
+			int x0=w*i/cw, x1=w*(i+1)/cw, y0=h*j/ch, y1=h*(j+1)/ch;
+			int x=std::min(x1-1,x0+(int)(xy[2*(i+j*cw)+0]*(x1-x0)));
+			int y=std::min(y1-1,y0+(int)(xy[2*(i+j*cw)+1]*(y1-y0)));
+			samples.push_back(x+y*w);
+		}
+		int corners[4]={0,w-1,(h-1)*w,w*h-1};
+		samples.insert(samples.end(),corners,corners+4);
+		std::sort(samples.begin(),samples.end());
+		samples.erase(std::unique(samples.begin(),samples.end()),samples.end());
+	}
+
+	/* Triangulate our samples, and interpolate the rest of the image */
+	void reconstruct(void) {
+		std::vector<delaunay::Point> pts(samples.size());
+		for (unsigned int i=0;i<samples.size();i++)
+			pts[i]=delaunay::Point(samples[i]%w,samples[i]/w);
+		triangle_list list;
+		delaunay::compute(pts,list);
+		tris.swap(list.tris);
+
+		image.resize(4*w*h);
+		std::vector<raster_job> jobs(threads);
+		std::vector<porthread_t> t(threads);
+		for (int i=0;i<threads;i++) {
+			jobs[i].r=this;
+			jobs[i].y0=h*i/threads; jobs[i].y1=h*(i+1)/threads;
+			if (i>0) t[i]=porthread_create(raster_worker,&jobs[i]);
+		}
+		raster_worker(&jobs[0]); // we do some too
+		for (int i=1;i<threads;i++) porthread_wait(t[i]);
+
+		if (!tex) glGenTextures(1,&tex);
+		glBindTexture(GL_TEXTURE_2D,tex);
+		glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA8,w,h,0,GL_RGBA,GL_UNSIGNED_BYTE,&image[0]);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D,0);
+	}
+
+	/* Per-pixel absolute and squared color error of our image, like bench.txt.
+	   This also becomes our importance map for next time. */
+	void error(double &err1,double &err2) {
+		err1=err2=0.0;
+		importance.resize(w*h);
+		for (int i=0;i<w*h;i++) {
+			importance[i]=0.0f;
+			for (int c=0;c<3;c++) {
+				double d=fabs(image[4*i+c]*(1.0/255.0)-truth[3*i+c]);
+				err1+=d; err2+=d*d;
+				importance[i]+=d;
+			}
+		}
+		err1/=w*h; err2/=w*h;
+	}
+
+private:
+	int threads;
+	sample_placement placer;
+	std::vector<unsigned char> source; // RGBA, full resolution
+	std::vector<float> truth; // RGB
+	std::vector<int> tris; // triangles, as three indices into samples
+
+	/* Collects delaunay triangles */
+	class triangle_list : public delaunay::Consumer {
+	public:
+		std::vector<int> tris;
+		virtual void delaunay_triangle(int a,int b,int c) {
+			tris.push_back(a); tris.push_back(b); tris.push_back(c);
+		}
+	};
+
+	struct raster_job {
+		scattered_renderer *r;
+		int y0,y1; // rows we own
+	};
+
+	/* Rasterize every triangle that touches our rows */
+	static void raster_worker(void *arg) {
+		raster_job *j=(raster_job *)arg;
+		scattered_renderer &r=*j->r;
+		int w=r.w;
+		for (unsigned int t=0;t<r.tris.size();t+=3) {
+			int s[3]; float x[3],y[3];
+			for (int k=0;k<3;k++) {
+				s[k]=r.samples[r.tris[t+k]];
+				x[k]=s[k]%w; y[k]=s[k]/w;
+			}
+			int ylo=std::max(j->y0,(int)std::min(y[0],std::min(y[1],y[2])));
+			int yhi=std::min(j->y1-1,(int)std::max(y[0],std::max(y[1],y[2])));
+			if (ylo>yhi) continue;
+			int xlo=(int)std::min(x[0],std::min(x[1],x[2]));
+			int xhi=(int)std::max(x[0],std::max(x[1],x[2]));
+			float area=(x[1]-x[0])*(y[2]-y[0])-(y[1]-y[0])*(x[2]-x[0]);
+			if (area<=0.0f) continue;
+			float inv=1.0f/area;
+			for (int py=ylo;py<=yhi;py++)
+			for (int px=xlo;px<=xhi;px++) {
+				// Barycentric weight of each corner: area of the opposite sub-triangle
+				float b0=((x[2]-x[1])*(py-y[1])-(y[2]-y[1])*(px-x[1]))*inv;
+				float b1=((x[0]-x[2])*(py-y[2])-(y[0]-y[2])*(px-x[2]))*inv;
+				float b2=1.0f-b0-b1;
+				if (b0<0.0f || b1<0.0f || b2<-1.0e-6f) continue; // outside this triangle
+				for (int c=0;c<4;c++)
+					r.image[4*(px+py*w)+c]=(unsigned char)(0.5f+
+						b0*r.source[4*s[0]+c]+b1*r.source[4*s[1]+c]+b2*r.source[4*s[2]+c]);
+			}
+		}
+	}
+};
+
+#endif
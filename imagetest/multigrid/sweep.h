@@ -0,0 +1,340 @@
+/**
+  In-process parameter sweep: replaces the old sweep.sh / metric.sh /
+  bench_target.sh loops, which rebuilt and relaunched ./main for every
+  image and every setting.
+
+  We compile the shader once, decode each source image once, keep one
+  multigrid_renderer per level count, and render every error metric x
+  level count x threshold for that image.  Each render is one row in
+  the results file; at the end we add a summary line per metric and
+  level count: the average image error at the -target render rate
+  (like bench_target.sh reported).
+
+  We also average each configuration (level count, metric,
+  interpolation, and coarsest level sample placement) over the whole image corpus, threshold by threshold,
+  to get its rate-distortion curve: samples per pixel versus error.
+  These curves go to <sweep file>.curves, the points on the Pareto
+  front across all of them go to <sweep file>.pareto (plot both with
+  pareto_plot.sh), and we print the best configuration and threshold
+  for the -target sample budget, and for the -maxerr error target.
+
+  Run like:
+      ./main -sweep sweep.txt -levels 2,3,4 -metric 23,25 -interp 0,2 -thresholds 1.0,0.5
+  Leave out a list to sweep the defaults below.  Images come from -img
+  (repeatable), or else every image in ../real and ../synthetic.
+  Each row also has PSNR, SSIM, and MS-SSIM (see quality.h), computed
+  on the GPU unless you ask for "-quality cpu" (or "-quality off").
+  Error metrics 300 to 303 use scattered samples instead of multigrid
+  (see scattered.h), at each sample rate in -rates.  Metrics 400 and
+  401 are least-squares fits (see lsfit.h); add -lscheck to check the
+  GPU's fits against the CPU's at every render.
+  (Public Domain)
+*/
+#ifndef __IMAGETEST_SWEEP_H
+#define __IMAGETEST_SWEEP_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <dirent.h>
+#include "quality.h"
+#include "scattered.h"
+
+std::vector<double> sweep_metrics, sweep_levels, sweep_interps, sweep_placements, sweep_thresholds;
+std::vector<double> sweep_rates; // samples per pixel, for scattered.h
+std::vector<std::string> sweep_images;
+
+/* Error metrics that use scattered.h, not the multigrid renderer */
+bool sweep_scattered(int metric) { return metric>=300 && metric<400; }
+
+/* Parse a comma-separated list of numbers, like "2,3,4" */
+std::vector<double> sweep_parse_list(const char *str) {
+	std::vector<double> list;
+	while (*str) {
+		char *end=0;
+		list.push_back(strtod(str,&end));
+		if (end==str) { printf("Can't parse number list '%s'\n",str); exit(1); }
+		str=end;
+		if (*str==',') str++;
+	}
+	return list;
+}
+
+/* Add the images in this directory to our sweep, in alphabetical order */
+void sweep_add_directory(const std::string &dir) {
+	std::vector<std::string> names;
+	DIR *d=opendir(dir.c_str());
+	if (!d) { printf("Can't open image directory '%s'\n",dir.c_str()); return; }
+	while (struct dirent *e=readdir(d)) {
+		std::string name=e->d_name;
+		size_t dot=name.rfind('.');
+		if (dot==std::string::npos) continue;
+		std::string ext=name.substr(dot);
+		if (ext==".jpg" || ext==".jpeg" || ext==".png" || ext==".bmp" || ext==".tga")
+			names.push_back(dir+"/"+name);
+	}
+	closedir(d);
+	std::sort(names.begin(),names.end());
+	sweep_images.insert(sweep_images.end(),names.begin(),names.end());
+}
+
+/* One render of a sweep: all values are per pixel, like bench.txt */
+struct sweep_point {
+	double threshold;
+	double render; // samples taken
+	double err1; // absolute color error
+	double err2; // squared color error
+	image_quality q; // perceptual quality (zero if not measured)
+};
+
+/* Add p into this running sum of points */
+void sweep_accumulate(sweep_point &sum,const sweep_point &p) {
+	sum.threshold=p.threshold;
+	sum.render+=p.render; sum.err1+=p.err1; sum.err2+=p.err2;
+	sum.q.psnr+=p.q.psnr; sum.q.ssim+=p.q.ssim; sum.q.msssim+=p.q.msssim;
+}
+
+/* One renderer configuration, with its own rate-distortion curve */
+struct sweep_config {
+	int levels, metric, interp, placement;
+	bool operator<(const sweep_config &o) const {
+		if (levels!=o.levels) return levels<o.levels;
+		if (metric!=o.metric) return metric<o.metric;
+		if (interp!=o.interp) return interp<o.interp;
+		return placement<o.placement;
+	}
+};
+
+/* A configuration and threshold: one point we could actually run with */
+struct sweep_choice {
+	sweep_config c;
+	sweep_point p; // averaged over the corpus
+	bool operator<(const sweep_choice &o) const {
+		if (p.render!=o.p.render) return p.render<o.p.render;
+		return p.err1<o.p.err1;
+	}
+};
+
+/* Print and write out this choice, as a comment line */
+void sweep_report(FILE *f,const char *why,const sweep_choice *b) {
+	char line[300];
+	if (b) snprintf(line,sizeof(line),"Best %s: levels%d metric%d interp%d place%d threshold %f (render %f, err1 %f, psnr %.2f, ssim %f)",
+		why,b->c.levels,b->c.metric,b->c.interp,b->c.placement,b->p.threshold,b->p.render,b->p.err1,b->p.q.psnr,b->p.q.ssim);
+	else snprintf(line,sizeof(line),"Best %s: no configuration gets there",why);
+	printf("%s\n",line);
+	fprintf(f,"# %s\n",line);
+}
+
+/* Return the absolute error where this threshold sweep crosses the target
+   render rate, interpolating between thresholds (or the closest point,
+   if the sweep never gets there). */
+double sweep_error_at(const std::vector<sweep_point> &curve,double target) {
+	for (unsigned int i=0;i+1<curve.size();i++) {
+		const sweep_point &a=curve[i], &b=curve[i+1];
+		if ((a.render-target)*(b.render-target)<=0.0 && a.render!=b.render) {
+			double f=(target-a.render)/(b.render-a.render);
+			return a.err1+f*(b.err1-a.err1);
+		}
+	}
+	unsigned int best=0;
+	for (unsigned int i=1;i<curve.size();i++)
+		if (fabs(curve[i].render-target)<fabs(curve[best].render-target)) best=i;
+	return curve[best].err1;
+}
+
+/* Run the whole sweep with this shader, at this resolution, and write sweep_file */
+void sweep_run(GLhandleARB prog,int wid,int ht) {
+	// Defaults are what the old shell scripts swept
+	if (sweep_metrics.size()==0) {
+		const int metrics[]={
+			 0, 1,  2, 3,  4, 5,  6, 7,  8, 9, 10,11,
+			20,21, 22,23, 24,25, 26,27, 28,29, 30,31,
+			       42,43, 44,45, 46,47, 48,49, 50,51,
+			              64,65, 66,67, 68,69, 70,71};
+		sweep_metrics.assign(metrics,metrics+sizeof(metrics)/sizeof(metrics[0]));
+	}
+	if (sweep_levels.size()==0) for (int l=2;l<=6;l++) sweep_levels.push_back(l);
+	if (sweep_interps.size()==0) sweep_interps.push_back(0); // bilinear
+	if (sweep_placements.size()==0) sweep_placements.push_back(0); // center
+	if (sweep_thresholds.size()==0) // like -bench
+		for (double t=2.0;sweep_thresholds.size()<42;t*=0.9) sweep_thresholds.push_back(t);
+	if (sweep_rates.size()==0) {
+		const double rates[]={0.05,0.1,0.15,0.2,0.3,0.4,0.5,0.7};
+		sweep_rates.assign(rates,rates+sizeof(rates)/sizeof(rates[0]));
+	}
+	if (sweep_images.size()==0) {
+		sweep_add_directory("../real");
+		sweep_add_directory("../synthetic");
+	}
+	double target=(bench_target>0.0)?bench_target:0.33;
+
+	FILE *f=fopen(sweep_file,"w");
+	if (!f) { printf("Can't create sweep results file '%s'\n",sweep_file); exit(1); }
+	fprintf(f,"# imagetest sweep: %d images at %dx%d, %d metrics x %d level counts x %d interpolations x %d placements x %d thresholds\n",
+		(int)sweep_images.size(),wid,ht,(int)sweep_metrics.size(),(int)sweep_levels.size(),
+		(int)sweep_interps.size(),(int)sweep_placements.size(),(int)sweep_thresholds.size());
+	fprintf(f,"# image	levels	metric	interp	place	threshold	render	err1	err2	psnr	ssim	msssim\n");
+
+	benchmode=1; // render error images
+	quality_meter meter;
+	scattered_renderer scattered;
+	std::map<int,multigrid_renderer *> renderers; // by level count
+	std::map<sweep_config,double> target_err; // summed over images
+	std::map<sweep_config,std::vector<sweep_point> > corpus; // curves, summed over images
+	double pixelScale=1.0/(wid*ht);
+	for (unsigned int i=0;i<sweep_images.size();i++) {
+		const char *image=sweep_images[i].c_str();
+		double start=0.001*glutGet(GLUT_ELAPSED_TIME);
+		glActiveTexture(GL_TEXTURE1);
+		GLuint srcTex=read_soil_jpeg(image,GL_RGBA8);
+		bind_source_image(prog,srcTex);
+		bind_ground_truth(prog,image,srcTex,wid,ht);
+
+		for (unsigned int li=0;li<sweep_levels.size();li++) {
+			int levels=(int)sweep_levels[li];
+			multigrid_renderer *&r=renderers[levels];
+			if (!r) r=new multigrid_renderer(wid,ht,levels);
+			for (unsigned int mi=0;mi<sweep_metrics.size();mi++)
+			for (unsigned int ii=0;ii<sweep_interps.size();ii++)
+			for (unsigned int pi=0;pi<sweep_placements.size();pi++) {
+				if (sweep_scattered((int)sweep_metrics[mi])) continue; // below
+				errormetric=(int)sweep_metrics[mi];
+				interpolation=(int)sweep_interps[ii];
+				placement_mode=(int)sweep_placements[pi];
+				r->importance.clear(); // importance comes from this configuration's last threshold
+				sweep_config c={levels,errormetric,interpolation,placement_mode};
+				std::vector<sweep_point> &sum=corpus[c];
+				sum.resize(sweep_thresholds.size(),sweep_point());
+				std::vector<sweep_point> curve;
+				for (unsigned int ti=0;ti<sweep_thresholds.size();ti++) {
+					sweep_point p;
+					p.threshold=sweep_thresholds[ti];
+					glFastUniform1f(prog,"threshold",(float)p.threshold);
+					r->render(prog);
+					p.render=last_render*pixelScale;
+					p.err1=last_error1*pixelScale/255.0;
+					p.err2=last_error2*pixelScale/(255.0*255.0);
+					GLuint finest=r->fb[0]->get_color(); // reconstructed image
+					if (quality_mode==1) p.q=meter.gpu(finest,truth.tex,wid,ht);
+					else if (quality_mode==2) p.q=meter.cpu(finest,truth.tex,wid,ht);
+					else p.q.psnr=p.q.ssim=p.q.msssim=0.0;
+					curve.push_back(p);
+					sweep_accumulate(sum[ti],p);
+					fprintf(f,"%s	%d	%d	%d	%d	%.6f	%.6f	%.6f	%.6f	%.3f	%.6f	%.6f\n",
+						image,levels,errormetric,interpolation,placement_mode,p.threshold,p.render,p.err1,p.err2,
+						p.q.psnr,p.q.ssim,p.q.msssim);
+				}
+				target_err[c]+=sweep_error_at(curve,target);
+			}
+		}
+
+		bool scattered_loaded=false;
+		for (unsigned int mi=0;mi<sweep_metrics.size();mi++) {
+			int metric=(int)sweep_metrics[mi];
+			if (!sweep_scattered(metric)) continue;
+			if (!scattered_loaded) { // read back this image's samples and truth
+				scattered.set_image(srcTex,truth.tex,wid,ht);
+				scattered_loaded=true;
+			}
+			scattered.importance.clear(); // no previous error for this metric yet
+			sweep_config c={0,metric,0,metric-300};
+			std::vector<sweep_point> &sum=corpus[c];
+			sum.resize(sweep_rates.size(),sweep_point());
+			std::vector<sweep_point> curve;
+			for (unsigned int ri=0;ri<sweep_rates.size();ri++) {
+				sweep_point p;
+				p.threshold=sweep_rates[ri];
+				scattered.place(metric-300,p.threshold);
+				scattered.reconstruct();
+				p.render=scattered.samples.size()*pixelScale;
+				scattered.error(p.err1,p.err2);
+				if (quality_mode==1) p.q=meter.gpu(scattered.tex,truth.tex,wid,ht);
+				else if (quality_mode==2) p.q=meter.cpu(scattered.tex,truth.tex,wid,ht);
+				else p.q.psnr=p.q.ssim=p.q.msssim=0.0;
+				curve.push_back(p);
+				sweep_accumulate(sum[ri],p);
+				fprintf(f,"%s	%d	%d	%d	%d	%.6f	%.6f	%.6f	%.6f	%.3f	%.6f	%.6f\n",
+					image,0,metric,0,c.placement,p.threshold,p.render,p.err1,p.err2,
+					p.q.psnr,p.q.ssim,p.q.msssim);
+			}
+			target_err[c]+=sweep_error_at(curve,target);
+		}
+		fflush(f);
+		glDeleteTextures(1,&srcTex);
+		printf("Swept %s in %.1f seconds\n",image,0.001*glutGet(GLUT_ELAPSED_TIME)-start);
+	}
+
+	// Summary, in the same format bench_target.sh used for runs/results.txt
+	int n=sweep_images.size();
+	for (std::map<sweep_config,double>::iterator it=target_err.begin();it!=target_err.end();++it) {
+		char line[200];
+		snprintf(line,sizeof(line),"Err: %.2f%% for target %f (%d images)	levels%d metric%d interp%d place%d",
+			it->second/n*100.0,target,n,it->first.levels,it->first.metric,it->first.interp,it->first.placement);
+		printf("%s\n",line);
+		fprintf(f,"# %s\n",line);
+	}
+
+	// Rate-distortion curve for each configuration, averaged over the corpus
+	std::string curves_name=std::string(sweep_file)+".curves";
+	FILE *fc=fopen(curves_name.c_str(),"w");
+	if (!fc) { printf("Can't create curves file '%s'\n",curves_name.c_str()); exit(1); }
+	std::vector<sweep_choice> choices;
+	for (std::map<sweep_config,std::vector<sweep_point> >::iterator it=corpus.begin();it!=corpus.end();++it) {
+		// One gnuplot data block per configuration (select with "index")
+		fprintf(fc,"# levels%d metric%d interp%d place%d\n",
+			it->first.levels,it->first.metric,it->first.interp,it->first.placement);
+		fprintf(fc,"# threshold	render	err1	err2	psnr	ssim	msssim\n");
+		for (unsigned int ti=0;ti<it->second.size();ti++) {
+			sweep_choice ch;
+			ch.c=it->first;
+			ch.p=it->second[ti];
+			ch.p.render/=n; ch.p.err1/=n; ch.p.err2/=n;
+			ch.p.q.psnr/=n; ch.p.q.ssim/=n; ch.p.q.msssim/=n;
+			fprintf(fc,"%.6f	%.6f	%.6f	%.6f	%.3f	%.6f	%.6f\n",
+				ch.p.threshold,ch.p.render,ch.p.err1,ch.p.err2,ch.p.q.psnr,ch.p.q.ssim,ch.p.q.msssim);
+			choices.push_back(ch);
+		}
+		fprintf(fc,"\n\n");
+	}
+	fclose(fc);
+
+	// Pareto front: going up in samples, keep only choices that lower the error
+	std::sort(choices.begin(),choices.end());
+	std::vector<sweep_choice> front;
+	for (unsigned int i=0;i<choices.size();i++)
+		if (front.size()==0 || choices[i].p.err1<front.back().p.err1)
+			front.push_back(choices[i]);
+	std::string pareto_name=std::string(sweep_file)+".pareto";
+	FILE *fp=fopen(pareto_name.c_str(),"w");
+	if (!fp) { printf("Can't create Pareto front file '%s'\n",pareto_name.c_str()); exit(1); }
+	fprintf(fp,"# Pareto front of %d configurations over %d images: nothing else is both cheaper and better\n",
+		(int)corpus.size(),n);
+	fprintf(fp,"# render	err1	err2	psnr	ssim	msssim	levels	metric	interp	place	threshold\n");
+	for (unsigned int i=0;i<front.size();i++) {
+		const sweep_choice &ch=front[i];
+		fprintf(fp,"%.6f	%.6f	%.6f	%.3f	%.6f	%.6f	%d	%d	%d	%d	%.6f\n",
+			ch.p.render,ch.p.err1,ch.p.err2,ch.p.q.psnr,ch.p.q.ssim,ch.p.q.msssim,
+			ch.c.levels,ch.c.metric,ch.c.interp,ch.c.placement,ch.p.threshold);
+	}
+	fclose(fp);
+
+	// Best choices are on the front: least error within budget, and fewest samples under the error target
+	const sweep_choice *budget=0, *cheapest=0;
+	for (unsigned int i=0;i<front.size();i++) {
+		if (front[i].p.render<=target) budget=&front[i];
+		if (!cheapest && bench_maxerr>0.0 && front[i].p.err1<=bench_maxerr) cheapest=&front[i];
+	}
+	char why[100];
+	snprintf(why,sizeof(why),"for sample budget %f",target);
+	sweep_report(f,why,budget);
+	if (bench_maxerr>0.0) {
+		snprintf(why,sizeof(why),"for error target %f",bench_maxerr);
+		sweep_report(f,why,cheapest);
+	}
+	fclose(f);
+	for (std::map<int,multigrid_renderer *>::iterator it=renderers.begin();it!=renderers.end();++it)
+		delete it->second;
+}
+
+#endif
@@ -1 +0,0 @@
-3
@@ -18,6 +18,30 @@
 	your_multigrid_proxy proxy; // proxy geometry
 	renderer->render(prog,error_threshold,proxy);
   
+  Samples can cost very different amounts (ray march steps, fractal
+  iterations, bounces).  If your sampler writes what each sample cost
+  to alpha, as multigridCostEncode(cost) (see aurora's raytrace.txt),
+  set costweight above zero and your refinement test can compare error
+  against multigridThreshold(cost) instead of threshold.
+  
+  Viewers only see full detail near where they're looking, so on domes
+  and in VR the periphery can tolerate much more error.  Set fovea's
+  gaze point and periphery (and optionally a threshold map texture,
+  like a HUD mask) each frame, and your shader can scale its threshold
+  by multigridFoveation(texcoords) (again, see aurora's raytrace.txt).
+  
+  For stereo (or any N views side by side), subclass multigrid_views
+  to set up each camera, and call render_views instead of render:
+  the coarsest levels are only rendered once, from the cyclopean camera.
+  
+  For live displays, set deadline to bound the frame time: render then
+  refines only as many tiles as last frame's GPU timers say will fit,
+  and interpolates the rest.
+  
+  While the camera and scene hold still, render_progressive refines the
+  same image a little more each frame, reusing every earlier sample,
+  until it's finished and you can stop drawing (see aurora's -progressive).
+  
   Dr. Orion Lawlor, lawlor@alaska.edu, 2014-03-28 (Public Domain)
 */
 #include "ogl/framebuffer.h"  // we use textures and framebuffer objects from here
@@ -26,6 +50,11 @@
 #include "ogl/fast_mipmaps.c"
 
 #include "ogl/glsl.h" // glFastUniform GLSL utilities
+#include <stdio.h>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <math.h>
 
 /**
  This proxy geometry renderer must draw all the pixels in the viewport.
@@ -43,6 +72,59 @@ public:
 };
 
 
+/**
+ Where the viewer is looking, and how fast the error they can see
+ grows away from there.  The threshold is scaled by 1.0 inside radius,
+ ramping smoothly up to periphery beyond radius+falloff.  Distances are
+ fractions of the image height, so the fovea stays round.
+*/
+class multigrid_foveation {
+public:
+	float x,y; // gaze point, in texture coordinates (0-1 across the image)
+	float radius; // full detail this far from the gaze point
+	float falloff; // then ramp up to the periphery's threshold over this distance
+	float periphery; // threshold scale far from the gaze point (1.0: no foveation)
+	GLuint map; // if nonzero, a texture whose red channel 0-1 scales threshold from 1 to map_scale
+	float map_scale; // threshold scale where the map is 1.0
+	
+	multigrid_foveation() 
+		:x(0.5f), y(0.5f), radius(0.2f), falloff(0.3f), periphery(1.0f),
+		 map(0), map_scale(10.0f) {}
+	
+	/**
+	 Read a new gaze point from this file, holding "x y" in texture
+	 coordinates, as an eye-tracker stand-in.  Re-read it every frame: if
+	 the file is missing or mid-rewrite, keep the old gaze point.
+	*/
+	bool read_gaze(const char *filename) {
+		FILE *f=fopen(filename,"r");
+		if (!f) return false;
+		float nx,ny;
+		bool ok=(2==fscanf(f,"%f %f",&nx,&ny));
+		fclose(f);
+		if (ok) { x=nx; y=ny; }
+		return ok;
+	}
+};
+
+
+/**
+ Cameras for a multi-view (stereo, dome, CAVE) render, drawn side by
+ side, left to right, each 1/count of the width.
+*/
+class multigrid_views {
+public:
+	int count; // number of views
+	multigrid_views(int count_) :count(count_) {}
+	virtual ~multigrid_views() {}
+	
+	/* Set up the projection matrix and shader uniforms (like the camera
+	   position) for view v, or for v==-1 the central (cyclopean) camera
+	   that renders the levels all the views share. */
+	virtual void set(GLhandleARB prog,int v) =0;
+};
+
+
 /**
  Renders an image in steps, from coarse to fine resolution.
  
@@ -64,12 +146,35 @@ public:
 #endif
 		+msaa}; // multigrid levels are from 0..levels-1.  level==msaa is the full resolution image
 	oglFramebuffer *fb[levels];
+	float fovy; // camera's vertical field of view, in degrees, as passed to gluPerspective
+	float costweight; // 0: same threshold everywhere; >0: scale it by sample cost (see render)
+	enum {cost_bits=12}; // alpha holds log2(1+cost)/cost_bits: must match the shader
+	multigrid_foveation fovea; // per-pixel threshold scaling, set up before each render
+	enum {map_unit=13}; // texture unit for fovea.map
+	int shared_levels; // render_views: how many coarse levels the views share
+	float progressive_step; // render_progressive: each pass multiplies the threshold by this...
+	int progressive_passes; // ...for this many passes...
+	float progressive_goal; // ...then one last pass at this threshold (0.0: the full-quality image)
+	float deadline; // render: milliseconds of GPU time the levels may take (0: no limit)
+	enum {deadline_tiles=8}; // render: with a deadline, each finer level is this many tiles across and down
 	
 	multigrid_renderer(int wid_,int ht_) 
+		:fovy(60.0f), costweight(0.0f), shared_levels(1),
+		 progressive_step(0.5f), progressive_passes(4), progressive_goal(0.0f),
+		 deadline(0.0f), pass(0), warmup(false), spent(0.0)
 	{
 		wid=wid_; ht=ht_;
 		for (int l=0;l<levels;l++) fb[l]=new oglFramebuffer(
 			(wid<<msaa)>>l,(ht<<msaa)>>l,GL_RGBA8);
+		for (int l=0;l<levels;l++) prev[l]=NULL;
+	}
+	~multigrid_renderer() {
+		for (int l=0;l<levels;l++) { delete fb[l]; delete prev[l]; }
+		for (unsigned int i=0;i<viewfb.size();i++) delete viewfb[i];
+		if (!queries.empty()) glDeleteQueries(queries.size(),&queries[0]);
+		if (!counts.empty()) glDeleteQueries(counts.size(),&counts[0]);
+		for (std::map<const oglFramebuffer *,cost_readback>::iterator it=costs.begin();it!=costs.end();++it)
+			glDeleteBuffersARB(1,&it->second.pbo);
 	}
 	
 	// Convert a framebuffer (size) to a vec4 giving x,y pixel size, z,w 1.0/pixel size
@@ -77,23 +182,89 @@ public:
 		return vec4(fbo->w,fbo->h,1.0/fbo->w,1.0/fbo->h);
 	}
 	
+	// Return the angle, in radians, subtended by one pixel of an image this
+	//   many pixels high at the center of the screen, given our fovy.
+	//   (The projection matrix can't tell us: gluLookAt often lives there.)
+	float pixel_footprint(float h) const {
+		return 2.0*tan(fovy*(M_PI/360.0))/h;
+	}
+	float pixel_footprint(const oglFramebuffer *fbo) const {
+		return pixel_footprint((float)fbo->h);
+	}
+	
+	/**
+	 Average sample cost on the coarsest level, where every pixel was sampled.
+	 The level's alpha is read back asynchronously, so this returns last
+	 frame's average (except the first time, which has to wait).
+	*/
+	float average_cost(void) { return average_cost(fb[levels-1]); }
+	float average_cost(oglFramebuffer *c) {
+		cost_readback &r=costs[c];
+		bool waiting=(r.w==c->w && r.h==c->h); // last frame's read fits
+		if (waiting) read_cost(r);
+		if (!r.pbo) glGenBuffersARB(1,&r.pbo);
+		r.w=c->w; r.h=c->h;
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,r.pbo);
+		glBufferDataARB(GL_PIXEL_PACK_BUFFER_ARB,r.w*r.h,NULL,GL_STREAM_READ_ARB);
+		glPixelStorei(GL_PACK_ALIGNMENT,1);
+		glReadPixels(0,0,r.w,r.h,GL_ALPHA,GL_UNSIGNED_BYTE,(void *)0);
+		glPixelStorei(GL_PACK_ALIGNMENT,4);
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+		if (!waiting) read_cost(r); // nothing older to go on
+		return r.mean;
+	}
+	
 	/**
 	 Loop over multigrid levels and do rendering.
+	 The finished image goes to the screen, or to dest if it's non-NULL.
+	 
+	 With costweight>0, a pixel whose samples cost c is held to
+	 threshold*(c/average)^costweight: for a fixed budget, the best
+	 samples to take are the ones that fix the most error per unit cost,
+	 so expensive pixels must be that much worse before we pay for them.
+	 
+	 With deadline>0, the finer levels are drawn in tiles.  First, an
+	 occlusion query per tile counts the pixels the error test flags
+	 (while multigridCountFlags is set, your shader must discard the
+	 pixels the coarser level fits, and not sample the rest), then the
+	 tiles are drawn, each level timed with a GPU timer query.  Last
+	 frame's timings fit each level's cost per flagged pixel, and with
+	 last frame's counts, tiles are refined in order of error (flagged
+	 pixels) per predicted millisecond, packing in every one that still
+	 fits under deadline.  The rest are drawn with an infinite threshold,
+	 so they just interpolate the coarser level: blurrier, but the frame
+	 time stays bounded.  A tile's priority grows each frame it's passed
+	 over, so it doesn't starve.  Predictions can be wrong, so as each
+	 level finishes we read its timer, and once the next level has counted
+	 its flags, we read those too: if the time so far plus that level's
+	 new prediction is over deadline, its tiles refined most recently
+	 interpolate instead, until the rest fit.
 	 FIXME: inputs & sampling part of shader should be parameterized
 	*/
-	void render(GLhandleARB prog,float threshold,multigrid_proxy &pixels) {
-		glFastUniform1f(prog,"threshold",threshold);
+	void render(GLhandleARB prog,float threshold,multigrid_proxy &pixels,
+		oglFramebuffer *dest=NULL) 
+	{
+		set_uniforms(prog,threshold);
+		bool timed=(deadline>0.0f);
+		if (timed) { plan_deadline(); spent=0.0; }
 		
 		// Start at coarsest level
 		glFastUniform1f(prog,"multigridCoarsest",1.0f);
+		glFastUniform1f(prog,"multigridFootprint",pixel_footprint(fb[levels-1]));
 		fb[levels-1]->bind();
+		if (timed) glBeginQuery(GL_TIME_ELAPSED_EXT,queries[levels-1]);
 		pixels.draw();
+		if (timed) glEndQuery(GL_TIME_ELAPSED_EXT);
+		if (costweight>0.0f) glFastUniform1f(prog,"multigridCostMean",average_cost());
 		
 		// Loop over finer and finer levels
 		for (int l=levels-2;l>=0;l--) {
 			float multigridCoarsest=l*1.0/(levels-1.0);
 			glFastUniform1f(prog,"multigridCoarsest",multigridCoarsest);
-			if (l==0) fb[levels-1]->unbind(); // last step: render to screen
+			if (l==0) { // last step: render to screen (or dest)
+				fb[levels-1]->unbind(); 
+				if (dest) dest->bind();
+			}
 			else fb[l]->bind(); // intermediate step: render to framebuffer
 			
 			// Bind coarser level to texture:
@@ -102,14 +273,443 @@ public:
 			glFastUniform1i(prog,"multigridCoarserTex",7);
 			glFastUniform4fv(prog,"multigridCoarser", 1, framebuffer2vec4(fb[l+1]) );
 			glFastUniform4fv(prog,"multigridFiner", 1, framebuffer2vec4(fb[l]) );
+			glFastUniform1f(prog,"multigridFootprint",pixel_footprint(fb[l]));
 			
 			// Render finer level
-			pixels.draw();
+			if (timed) draw_tiles(prog,pixels,l,threshold);
+			else pixels.draw();
 		}
+		if (dest) dest->unbind();
 		
 		glBindTexture(GL_TEXTURE_2D,0); // clear texture state
 		glActiveTexture(GL_TEXTURE0);
 	}
+	
+	/* Start progressive refinement over: the camera or scene changed */
+	void restart(void) { pass=0; }
+	
+	/* True once render_progressive has finished the image */
+	bool converged(void) const { return pass>progressive_passes; }
+	
+	/**
+	 Progressive refinement, for a still camera.  Call restart() whenever
+	 anything onscreen changes, then call this every frame.  The first pass
+	 renders at threshold, like render, each later one at progressive_step
+	 times the last one's threshold, and the final pass at progressive_goal.
+	 Every pixel any pass sampled is kept, and stenciled out so the shader
+	 never even runs there again: a pass only samples the pixels its
+	 tighter threshold newly flags, and cheaply reinterpolates the rest
+	 from the improved coarser levels.  Returns true once the image is
+	 finished: later calls just redraw it, so you can stop asking for
+	 frames until something changes.
+	 
+	 While multigridProgressive is set, your shader must write alpha 1.0
+	 where it samples and 0.0 where it interpolates (see aurora's
+	 raytrace.txt).  That leaves no room in alpha for sample costs, so
+	 costweight is ignored here.
+	*/
+	bool render_progressive(GLhandleARB prog,float threshold,multigrid_proxy &pixels,
+		oglFramebuffer *dest=NULL) 
+	{
+		if (!converged()) {
+			if (!prev[0]) for (int l=0;l<levels;l++) { // both sets of levels need stencil
+				if (!fb[l]->get_stencil()) { forget_cost(fb[l]); delete fb[l]; fb[l]=stencil_fb(l); }
+				prev[l]=stencil_fb(l);
+			}
+			float t=progressive_goal;
+			if (pass<progressive_passes) t=threshold*pow(progressive_step,pass);
+			float saved=costweight; costweight=0.0f;
+			set_uniforms(prog,t);
+			glFastUniform1f(prog,"multigridProgressive",1.0f);
+			
+			// Render each level into prev, keeping the last pass's samples from fb
+			for (int l=levels-1;l>=0;l--) {
+				prev[l]->bind();
+				keep_samples(prog,pass>0?fb[l]:NULL);
+				if (pass>0) glEnable(GL_STENCIL_TEST); // pass 0 has nothing to keep
+				glStencilFunc(GL_EQUAL,0,0xff);
+				glStencilOp(GL_KEEP,GL_KEEP,GL_KEEP);
+				draw_level(prog,pixels,l,NULL,l+1<levels?prev[l+1]:NULL,framebuffer2vec4(prev[l]));
+				glDisable(GL_STENCIL_TEST);
+				prev[l]->unbind();
+			}
+			for (int l=0;l<levels;l++) std::swap(fb[l],prev[l]);
+			
+			glFastUniform1f(prog,"multigridProgressive",0.0f);
+			costweight=saved;
+			glActiveTexture(GL_TEXTURE7);
+			glBindTexture(GL_TEXTURE_2D,0); // clear texture state
+			glActiveTexture(GL_TEXTURE0);
+			pass++;
+			if (converged()) free_prev(); // fb has the finished image: prev is only needed again after restart
+		}
+		
+		// Copy the finished level to the viewport (or dest)
+		GLint vp[4]; glGetIntegerv(GL_VIEWPORT,vp);
+		if (dest) { vp[0]=vp[1]=0; vp[2]=dest->w; vp[3]=dest->h; }
+		glBindFramebufferEXT(GL_READ_FRAMEBUFFER_EXT,fb[0]->get_handle());
+		glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER_EXT,dest?dest->get_handle():0);
+		glBlitFramebufferEXT(0,0,fb[0]->w,fb[0]->h,vp[0],vp[1],vp[0]+vp[2],vp[1]+vp[3],
+			GL_COLOR_BUFFER_BIT,GL_NEAREST);
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,0);
+		return converged();
+	}
+	
+	/**
+	 Render views.count views side by side, each (wid/views.count) x ht.
+	 The coarsest shared_levels levels are only rendered once, from the
+	 cyclopean camera, and the views each refine from there.  Sharing is
+	 only right while the views' disparity at the shared levels is well
+	 under a pixel, as for distant scenery: with near objects, use
+	 shared_levels=0 to render each view independently.
+	 
+	 Your shader must subtract multigridOrigin from gl_FragCoord (the
+	 views' final levels land at different places on the screen).
+	*/
+	void render_views(GLhandleARB prog,float threshold,multigrid_proxy &pixels,
+		multigrid_views &views,oglFramebuffer *dest=NULL) 
+	{
+		int n=views.count, vw=wid/n;
+		int shared=std::max(0,std::min(levels-1,shared_levels));
+		GLint vp[4]; glGetIntegerv(GL_VIEWPORT,vp);
+		set_uniforms(prog,threshold);
+		
+		// Levels everybody shares, from the central camera
+		if (shared>0) views.set(prog,-1);
+		for (int l=levels-1;l>=levels-shared;l--)
+			draw_level(prog,pixels,l,view_fb(n,l,vw),l+1<levels?view_fb(n,l+1,vw):NULL);
+		
+		// Finer levels, per view
+		for (int v=0;v<n;v++) {
+			views.set(prog,v);
+			for (int l=levels-1-shared;l>=0;l--) {
+				oglFramebuffer *coarser=NULL;
+				if (l+1<levels) coarser=view_fb(l+1>=levels-shared?n:v,l+1,vw);
+				if (l>0) draw_level(prog,pixels,l,view_fb(v,l,vw),coarser);
+				else { // last step: our part of the screen (or dest)
+					if (dest) dest->bind();
+					int x=(dest?0:vp[0])+v*vw, y=dest?0:vp[1];
+					glViewport(x,y,vw,ht);
+					draw_level(prog,pixels,l,NULL,coarser,vec4(vw,ht,1.0/vw,1.0/ht),x,y);
+					if (dest) dest->unbind();
+				}
+			}
+		}
+		glViewport(vp[0],vp[1],vp[2],vp[3]);
+		float zero[2]={0.0f,0.0f}; // plain render() doesn't set multigridOrigin
+		glFastUniform2fv(prog,"multigridOrigin",1,zero);
+		
+		glActiveTexture(GL_TEXTURE7);
+		glBindTexture(GL_TEXTURE_2D,0); // clear texture state
+		glActiveTexture(GL_TEXTURE0);
+	}
+	
+private:
+	oglFramebuffer *prev[levels]; // render_progressive: the other set of levels it alternates with fb (NULL once converged)
+	int pass; // render_progressive: passes since restart
+	
+	/* render's deadline: the finer levels' tiles, level l's starting at [l*deadline_tiles^2] */
+	struct deadline_tile {
+		GLuint flags; // pixels the error test flagged last frame: the error we'd fix
+		int age; // frames since it was last refined
+		bool refine; // refine it this frame
+		deadline_tile() :flags(0), age(0), refine(true) {}
+	};
+	std::vector<deadline_tile> tiles;
+	
+	/* render's deadline: a finer level's milliseconds, fit as fixed+per_flag*(flags refined).
+	   One tile's timer is too noisy to trust (drivers bill deferred work to
+	   whatever query is open), but a whole level's adds up. */
+	struct deadline_fit {
+		double n,x,y,xx,xy; // decaying sums over frames of 1, flags refined, ms, and products
+		double fixed; // milliseconds to count flags and interpolate the whole level
+		double per_flag; // extra milliseconds per flagged pixel refined
+		deadline_fit() :n(0.0),x(0.0),y(0.0),xx(0.0),xy(0.0),fixed(0.0),per_flag(-1.0) {}
+		void add(double flags,double ms) {
+			const double keep=0.8; // older frames fade out
+			n=keep*n+1.0; x=keep*x+flags; y=keep*y+ms;
+			xx=keep*xx+flags*flags; xy=keep*xy+flags*ms;
+			double mx=x/n, my=y/n, var=xx/n-mx*mx;
+			if (var>1.0e-4*mx*mx+1.0) // frames differ enough to fit a line
+				per_flag=std::max(0.0,(xy/n-mx*my)/var);
+			else if (per_flag<0.0) // first frame: blame it all on the flags, to err early
+				per_flag=my/std::max(mx,1.0);
+			fixed=std::max(0.0,my-per_flag*mx);
+		}
+	};
+	std::vector<deadline_fit> fits; // [l] fits finer level l
+	bool warmup; // the last frame was the first: its timings are no good
+	std::vector<GLuint> queries; // timers: [l] times level l (for finer levels, counting flags and all its tiles)
+	std::vector<double> level_ms; // [l] is level l's last timer reading, in milliseconds
+	double spent; // milliseconds this frame's levels have taken so far
+	std::vector<GLuint> counts; // occlusion queries: [i] counts a sample of tiles[i]'s flagged pixels
+	
+	/* average_cost: a coarsest level's alpha, read back a frame late */
+	struct cost_readback {
+		GLuint pbo; // pixel buffer object the read lands in
+		int w,h; // size of the read in flight (0: none)
+		float mean; // average cost, as of the last read
+		cost_readback() :pbo(0), w(0), h(0), mean(1.0f) {}
+	};
+	std::map<const oglFramebuffer *,cost_readback> costs; // by the level read
+	
+	/* Finish r's read, and average its costs */
+	void read_cost(cost_readback &r) {
+		static float decode[256]; // alpha to cost, as multigridCostEncode
+		if (decode[255]==0.0f) for (int a=0;a<256;a++) decode[a]=pow(2.0,a*(cost_bits/255.0))-1.0;
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,r.pbo);
+		const unsigned char *alpha=(const unsigned char *)glMapBufferARB(GL_PIXEL_PACK_BUFFER_ARB,GL_READ_ONLY_ARB);
+		if (alpha) {
+			double sum=0.0;
+			for (int i=0;i<r.w*r.h;i++) sum+=decode[alpha[i]];
+			r.mean=std::max(sum/(r.w*r.h),1.0e-3);
+			glUnmapBufferARB(GL_PIXEL_PACK_BUFFER_ARB);
+		}
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+	}
+	void forget_cost(const oglFramebuffer *c) { // c is going away
+		std::map<const oglFramebuffer *,cost_readback>::iterator it=costs.find(c);
+		if (it==costs.end()) return;
+		glDeleteBuffersARB(1,&it->second.pbo);
+		costs.erase(it);
+	}
+	std::vector<oglFramebuffer *> viewfb; // render_views levels: view v level l is [v*levels+l], the cyclopean view is v==count
+	
+	/* Threshold and friends, shared by all levels */
+	void set_uniforms(GLhandleARB prog,float threshold) {
+		glFastUniform1f(prog,"threshold",threshold);
+		glFastUniform1f(prog,"multigridCostWeight",costweight);
+		glFastUniform4fv(prog,"multigridFovea",1,vec4(fovea.x,fovea.y,fovea.radius,fovea.falloff));
+		glFastUniform1f(prog,"multigridPeriphery",fovea.periphery);
+		glFastUniform1f(prog,"multigridThresholdMapScale",fovea.map?fovea.map_scale:0.0f);
+		glFastUniform1i(prog,"multigridThresholdMap",map_unit);
+		if (fovea.map) {
+			glActiveTexture(GL_TEXTURE0+map_unit);
+			glBindTexture(GL_TEXTURE_2D,fovea.map);
+			glActiveTexture(GL_TEXTURE0);
+		}
+	}
+	
+	/* Read back last frame's GPU timers and flag counts, and pick this frame's tiles to refine */
+	void plan_deadline(void) {
+		int T2=deadline_tiles*deadline_tiles, n=(levels-1)*T2;
+		if (tiles.empty()) { // first frame: refine everything, to measure it
+			tiles.resize(n);
+			fits.resize(levels-1);
+			queries.resize(levels);
+			glGenQueries(levels,&queries[0]);
+			level_ms.assign(levels,0.0);
+			counts.resize(n);
+			glGenQueries(n,&counts[0]);
+			warmup=true;
+			return;
+		}
+		std::vector<double> refined(levels-1,0.0); // flags each level refined last frame
+		for (int i=0;i<n;i++) {
+			deadline_tile &t=tiles[i];
+			GLuint ready=0; // else keep the older count, rather than wait on the GPU
+			glGetQueryObjectuiv(counts[i],GL_QUERY_RESULT_AVAILABLE,&ready);
+			if (ready) glGetQueryObjectuiv(counts[i],GL_QUERY_RESULT,&t.flags);
+			if (t.refine) { refined[i/T2]+=t.flags; t.age=0; }
+			else t.age++;
+		}
+		bool finest=read_level_ms(0,false); // the coarser levels were read during last frame
+		if (warmup) { // the first frame's times include compiling shaders: measure again
+			warmup=false;
+			return;
+		}
+		double total=level_ms[levels-1]; // predicted, if we refine nothing
+		for (int l=0;l<levels-1;l++) {
+			if (l>0 || finest) fits[l].add(refined[l],level_ms[l]);
+			total+=fits[l].fixed;
+		}
+		
+		std::vector<std::pair<double,int> > order(n); // by decreasing error per ms, then tile number
+		std::vector<double> extra(n); // predicted milliseconds refining costs over interpolating
+		for (int i=0;i<n;i++) {
+			deadline_tile &t=tiles[i];
+			int l=i/T2;
+			extra[i]=fits[l].per_flag*t.flags;
+			double error=t.flags*double(1<<(2*l)); // a level l flag covers 4^l level 0 pixels
+			error*=1.0+0.1*t.age; // passed-over tiles move up the list
+			order[i]=std::make_pair(-error/std::max(extra[i],1.0e-6),i);
+		}
+		std::sort(order.begin(),order.end());
+		for (int k=0;k<n;k++) { // greedy knapsack: most error fixed per ms first
+			int i=order[k].second;
+			deadline_tile &t=tiles[i];
+			t.refine=(total+extra[i]<=deadline); // else keep looking for one that fits
+			if (t.refine) total+=extra[i];
+		}
+	}
+	
+	/* Read level l's timer into level_ms[l]; unless wait, only if it's ready */
+	bool read_level_ms(int l,bool wait) {
+		GLuint ready=1;
+		if (!wait) glGetQueryObjectuiv(queries[l],GL_QUERY_RESULT_AVAILABLE,&ready);
+		if (!ready) return false;
+		GLuint64EXT ns=0;
+		glGetQueryObjectui64vEXT(queries[l],GL_QUERY_RESULT,&ns);
+		level_ms[l]=ns*1.0e-6;
+		return true;
+	}
+	
+	/* Finer level l has counted its flags: add the coarser level's time to
+	   spent, and drop refined tiles until level l's prediction from this
+	   frame's counts fits under deadline.  Reading these results waits for
+	   the GPU, but level l's tiles read the coarser level's pixels, so the
+	   GPU couldn't have got far ahead anyway. */
+	void check_deadline(int l) {
+		read_level_ms(l+1,true);
+		spent+=level_ms[l+1];
+		int T2=deadline_tiles*deadline_tiles;
+		std::vector<std::pair<int,int> > refined; // by age, then tile number
+		for (int i=l*T2;i<(l+1)*T2;i++) {
+			glGetQueryObjectuiv(counts[i],GL_QUERY_RESULT,&tiles[i].flags);
+			if (tiles[i].refine) refined.push_back(std::make_pair(tiles[i].age,i));
+		}
+		if (fits[l].per_flag<0.0) return; // still measuring: refine as planned
+		double need=spent+fits[l].fixed;
+		for (int k=0;k<l;k++) need+=fits[k].fixed; // finer levels at least interpolate
+		for (unsigned int k=0;k<refined.size();k++) need+=fits[l].per_flag*tiles[refined[k].second].flags;
+		std::sort(refined.begin(),refined.end()); // within a level, error per ms is the same: age decides
+		for (unsigned int k=0;k<refined.size() && need>deadline;k++) {
+			deadline_tile &t=tiles[refined[k].second];
+			t.refine=false;
+			need-=fits[l].per_flag*t.flags;
+		}
+	}
+	
+	/* Draw finer level l in tiles, interpolating the ones we can't afford */
+	void draw_tiles(GLhandleARB prog,multigrid_proxy &pixels,int l,float threshold) {
+		int T=deadline_tiles;
+		GLint vp[4]; glGetIntegerv(GL_VIEWPORT,vp);
+		glBeginQuery(GL_TIME_ELAPSED_EXT,queries[l]);
+		glEnable(GL_SCISSOR_TEST);
+		
+		// Count the pixels each tile's error test flags, drawing nothing.  Each
+		//   coarser pixel's 2x2 finer pixels share one fit, and to rank tiles a
+		//   sample of one fit in four will do, so count at half the coarser size.
+		int cw=fb[l+1]->w/2, ch=fb[l+1]->h/2;
+		glPushAttrib(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT|GL_VIEWPORT_BIT);
+		glColorMask(GL_FALSE,GL_FALSE,GL_FALSE,GL_FALSE);
+		glDepthMask(GL_FALSE);
+		glViewport(vp[0],vp[1],cw,ch);
+		glFastUniform4fv(prog,"multigridFiner",1,vec4(cw,ch,1.0/cw,1.0/ch));
+		glFastUniform1f(prog,"multigridCountFlags",1.0f);
+		for (int y=0;y<T;y++)
+		for (int x=0;x<T;x++) {
+			int i=(l*T+y)*T+x; // tiles are numbered from level 0
+			int x0=vp[0]+x*cw/T, y0=vp[1]+y*ch/T;
+			glScissor(x0,y0,vp[0]+(x+1)*cw/T-x0,vp[1]+(y+1)*ch/T-y0);
+			glBeginQuery(GL_SAMPLES_PASSED,counts[i]);
+			pixels.draw();
+			glEndQuery(GL_SAMPLES_PASSED);
+		}
+		glFastUniform1f(prog,"multigridCountFlags",0.0f);
+		glFastUniform4fv(prog,"multigridFiner",1,framebuffer2vec4(fb[l]));
+		glPopAttrib();
+		check_deadline(l);
+		
+		// Draw the tiles, refining the ones we picked
+		for (int y=0;y<T;y++)
+		for (int x=0;x<T;x++) {
+			int i=(l*T+y)*T+x;
+			int x0=vp[0]+x*vp[2]/T, y0=vp[1]+y*vp[3]/T;
+			glScissor(x0,y0,vp[0]+(x+1)*vp[2]/T-x0,vp[1]+(y+1)*vp[3]/T-y0);
+			glFastUniform1f(prog,"threshold",tiles[i].refine?threshold:1.0e30f);
+			pixels.draw();
+		}
+		glDisable(GL_SCISSOR_TEST);
+		glFastUniform1f(prog,"threshold",threshold);
+		glEndQuery(GL_TIME_ELAPSED_EXT);
+	}
+	
+	/* Free render_progressive's other set of levels */
+	void free_prev(void) {
+		for (int l=0;l<levels;l++) { forget_cost(prev[l]); delete prev[l]; prev[l]=NULL; }
+	}
+	
+	/* A level for render_progressive, with stencil if the card can do it
+	   (without, the shader just reruns on kept pixels: slower, same image) */
+	oglFramebuffer *stencil_fb(int l) {
+		int w=(wid<<msaa)>>l, h=(ht<<msaa)>>l;
+		oglFramebuffer *f=new oglFramebuffer(w,h,GL_RGBA8,GL_DEPTH24_STENCIL8_EXT);
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,f->get_handle());
+		GLenum status=glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,0);
+		if (status==GL_FRAMEBUFFER_COMPLETE_EXT) return f;
+		delete f;
+		return new oglFramebuffer(w,h,GL_RGBA8);
+	}
+	
+	/* Clear the bound framebuffer's stencil (and depth), then copy in the pixels
+	   the previous pass sampled (alpha over 0.5), stenciling them to 1. */
+	void keep_samples(GLhandleARB prog,oglFramebuffer *previous) {
+		glClearStencil(0);
+		glClear(GL_STENCIL_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+		if (!previous) return;
+		static GLhandleARB keep=makeProgramObject(
+			"void main(void) { gl_Position=gl_Vertex; }\n",
+			"uniform sampler2D previous; uniform vec2 size;\n"
+			"void main(void) {\n"
+			"	vec4 c=texture2D(previous,gl_FragCoord.xy/size);\n"
+			"	if (c.a<=0.5) discard; // interpolated: the shader redoes it\n"
+			"	gl_FragColor=c;\n"
+			"}\n");
+		glUseProgramObjectARB(keep);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D,previous->get_color());
+		glFastUniform1i(keep,"previous",0);
+		float size[2]={(float)previous->w,(float)previous->h};
+		glFastUniform2fv(keep,"size",1,size);
+		glPushAttrib(GL_ENABLE_BIT|GL_STENCIL_BUFFER_BIT);
+		glDisable(GL_CULL_FACE);
+		glDisable(GL_BLEND);
+		glEnable(GL_STENCIL_TEST);
+		glStencilFunc(GL_ALWAYS,1,0xff);
+		glStencilOp(GL_KEEP,GL_KEEP,GL_REPLACE);
+		glBegin(GL_QUADS);
+		glVertex2f(-1,-1); glVertex2f(+1,-1); glVertex2f(+1,+1); glVertex2f(-1,+1);
+		glEnd();
+		glPopAttrib();
+		glBindTexture(GL_TEXTURE_2D,0);
+		glUseProgramObjectARB(prog);
+	}
+	
+	/* Framebuffer for level l of view v, each view vw pixels wide at full resolution */
+	oglFramebuffer *view_fb(int v,int l,int vw) {
+		unsigned int i=v*levels+l;
+		if (viewfb.size()<=i) viewfb.resize(i+1,NULL);
+		oglFramebuffer *&f=viewfb[i];
+		if (f && (f->w!=((vw<<msaa)>>l) || f->h!=((ht<<msaa)>>l))) { forget_cost(f); delete f; f=NULL; } // views changed
+		if (!f) f=new oglFramebuffer((vw<<msaa)>>l,(ht<<msaa)>>l,GL_RGBA8);
+		return f;
+	}
+	
+	/* Render level l into target (or, if NULL, whatever's bound, of this size
+	   and origin), refining coarser (or, if NULL, sampling everything) */
+	void draw_level(GLhandleARB prog,multigrid_proxy &pixels,int l,
+		oglFramebuffer *target,oglFramebuffer *coarser,
+		vec4 size=vec4(0,0,0,0),int x=0,int y=0)
+	{
+		if (target) { target->bind(); size=framebuffer2vec4(target); }
+		glFastUniform1f(prog,"multigridCoarsest",coarser?l*1.0/(levels-1.0):1.0f);
+		float origin[2]={(float)x,(float)y};
+		glFastUniform2fv(prog,"multigridOrigin",1,origin);
+		glFastUniform4fv(prog,"multigridFiner", 1, size);
+		glFastUniform1f(prog,"multigridFootprint",pixel_footprint(size.y));
+		if (coarser) {
+			glActiveTexture(GL_TEXTURE7);
+			glBindTexture(GL_TEXTURE_2D,coarser->get_color());
+			glFastUniform1i(prog,"multigridCoarserTex",7);
+			glFastUniform4fv(prog,"multigridCoarser", 1, framebuffer2vec4(coarser) );
+			glActiveTexture(GL_TEXTURE0);
+		}
+		pixels.draw();
+		if (!coarser && costweight>0.0f) glFastUniform1f(prog,"multigridCostMean",average_cost(target));
+		if (target) target->unbind();
+	}
 };
 
 /**
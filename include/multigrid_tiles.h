@@ -0,0 +1,219 @@
+/**
+  Sort-first distributed multigrid rendering, for screens too big for
+  one node, like a tiled display wall.
+
+  We split the screen into a grid of tiles, and each MPI rank renders
+  its tiles with its own tile-sized multigrid_renderer.  Multigrid makes
+  tiles very uneven: a smooth tile may sample 3% of its pixels, while a
+  busy one samples 80%.  So rather than giving each rank a fixed block
+  of the screen, we count the samples each tile took last frame, and
+  reassign the tiles every frame, biggest first, to whichever rank has
+  the least work so far (greedy longest-processing-time scheduling).
+  Every rank knows every tile's count (we MPI_Allreduce them), and the
+  assignment is deterministic, so nobody needs to send it around.
+
+  The finished tiles are gathered to rank 0, which draws them onscreen.
+  Each tile renders with an apron of extra pixels around it, so the
+  coarse levels' interpolation near tile edges sees the same neighbors
+  it would in one big image, and tile seams don't show.  Tiles and
+  aprons are whole coarsest-level pixels, so every tile's coarse pixels
+  line up with everybody else's.
+
+  The app's vertex shader must draw through a "subwindow" matrix, like
+  MPIglut's (see fractal's vertex.txt), which we set to zoom in on each
+  tile.  To count samples, the shader's last pass must write alpha 1.0
+  where it sampled and 0.0 where it interpolated when the
+  multigridCountSamples uniform is set.
+
+  Include this after multigrid.h.  multigrid_tiles (the assignment)
+  doesn't need MPI; multigrid_distributed (the rendering) does, and
+  needs USE_MPI defined and <mpi.h> included.
+  (Public Domain)
+*/
+#ifndef __MULTIGRID_TILES_H
+#define __MULTIGRID_TILES_H
+
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+/** Which rank renders each tile of the screen. */
+class multigrid_tiles {
+public:
+	int W,H; // whole screen, in pixels
+	int tx,ty; // tiles across and down
+	enum {coarsest=1<<(multigrid_renderer::levels-1)}; // pixels per coarsest-level pixel
+	int tw,th; // pixels per tile (the last row and column may hang off the screen)
+	int apron; // extra pixels rendered around each tile (but not drawn)
+	int ranks; // number of renderers
+	bool balance; // true: assign by cost.  false: fixed contiguous blocks.
+	std::vector<double> cost; // per tile: work it took last frame
+	std::vector<int> owner; // per tile: rank that renders it
+
+	multigrid_tiles(int W_,int H_,int tx_,int ty_,int ranks_,bool balance_=true)
+		:W(W_), H(H_), tx(tx_), ty(ty_), tw(round_up(W_,tx_)), th(round_up(H_,ty_)),
+		 apron(2*coarsest), ranks(ranks_), balance(balance_), cost(tx_*ty_,1.0), owner(tx_*ty_,0)
+	{ assign(); }
+
+	int count(void) const {return tx*ty;}
+	
+	/* Pixels per tile, to split n pixels into t tiles of whole coarsest pixels */
+	static int round_up(int n,int t) {
+		int c=(n+coarsest*t-1)/(coarsest*t);
+		return c*coarsest;
+	}
+
+	/* Bottom left pixel of tile t (tiles go left to right, then bottom to top) */
+	int x0(int t) const {return (t%tx)*tw;}
+	int y0(int t) const {return (t/tx)*th;}
+
+	/** Reassign every tile to a rank, using cost. */
+	void assign(void) {
+		int n=count();
+		if (!balance) { // contiguous blocks of tiles, like one screen per node
+			for (int t=0;t<n;t++) owner[t]=t*ranks/n;
+			return;
+		}
+		std::vector<std::pair<double,int> > order(n); // by decreasing cost, then tile number
+		for (int t=0;t<n;t++) order[t]=std::make_pair(-cost[t],t);
+		std::sort(order.begin(),order.end());
+		std::vector<double> load(ranks,0.0);
+		for (int i=0;i<n;i++) {
+			int t=order[i].second;
+			int r=std::min_element(load.begin(),load.end())-load.begin();
+			owner[t]=r;
+			load[r]+=cost[t];
+		}
+	}
+
+	/** Total cost of each rank's tiles, for these per-tile costs. */
+	std::vector<double> loads(const std::vector<double> &c) const {
+		std::vector<double> load(ranks,0.0);
+		for (int t=0;t<count();t++) load[owner[t]]+=c[t];
+		return load;
+	}
+
+	/**
+	 Subwindow matrix that makes tile t and its apron fill the viewport, as
+	 a column-major OpenGL matrix: it maps that part of clip space to -1..+1.
+	*/
+	void subwindow(int t,float m[16]) const {
+		double l=2.0*(x0(t)-apron)/W-1.0, r=2.0*(x0(t)+tw+apron)/W-1.0;
+		double b=2.0*(y0(t)-apron)/H-1.0, u=2.0*(y0(t)+th+apron)/H-1.0;
+		for (int i=0;i<16;i++) m[i]=(i%5==0)?1.0f:0.0f;
+		m[0]=2.0/(r-l); m[12]=-(r+l)/(r-l);
+		m[5]=2.0/(u-b); m[13]=-(u+b)/(u-b);
+	}
+};
+
+#ifdef USE_MPI
+/**
+ Sets the app's subwindow matrix for each tile.
+*/
+class multigrid_subwindow {
+public:
+	virtual ~multigrid_subwindow() {}
+	virtual void set(GLhandleARB prog,const float m[16]) =0;
+};
+
+/** Renders the screen's tiles across MPI ranks, balanced by sample counts. */
+class multigrid_distributed {
+public:
+	int rank,size; // our MPI rank, and how many there are
+	multigrid_tiles tiles;
+	std::vector<double> busy; // on rank 0: CPU seconds each rank spent rendering last frame (with a software GL, the render time even when ranks share cores)
+
+	multigrid_distributed(int W,int H,int tx,int ty,bool balance=true)
+		:tiles(W,H,tx,ty,mpi_size(),balance)
+	{
+		MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+		MPI_Comm_size(MPI_COMM_WORLD,&size);
+		int a=2*tiles.apron;
+		renderer=new multigrid_renderer(tiles.tw+a,tiles.th+a);
+		tile=new oglFramebuffer(tiles.tw+a,tiles.th+a,GL_RGBA8);
+		busy.resize(size,0.0);
+	}
+	~multigrid_distributed() { delete renderer; delete tile; }
+
+	/**
+	 Everybody renders their tiles, and rank 0 draws the whole screen.
+	 Collective: every rank must call this every frame.
+	*/
+	void render(GLhandleARB prog,float threshold,multigrid_proxy &proxy,
+		multigrid_subwindow &sub)
+	{
+		int n=tiles.count(), npix=tiles.tw*tiles.th;
+		int a=tiles.apron, aw=tiles.tw+2*a, ah=tiles.th+2*a; // tile with apron
+		std::vector<unsigned char> rendered(4*aw*ah);
+		tiles.assign(); // from last frame's counts
+
+		// Render our tiles
+		clock_t start=clock();
+		std::vector<unsigned char> mine; // our tiles' RGBA, in tile order
+		std::vector<double> counts(n,0.0); // our tiles' samples
+		glFastUniform1f(prog,"multigridCountSamples",1.0f);
+		for (int t=0;t<n;t++) if (tiles.owner[t]==rank) {
+			float m[16];
+			tiles.subwindow(t,m);
+			sub.set(prog,m);
+			renderer->render(prog,threshold,proxy,tile);
+
+			glBindTexture(GL_TEXTURE_2D,tile->get_color());
+			glGetTexImage(GL_TEXTURE_2D,0,GL_RGBA,GL_UNSIGNED_BYTE,&rendered[0]);
+			glBindTexture(GL_TEXTURE_2D,0);
+			mine.resize(mine.size()+4*npix); // keep the tile, minus its apron
+			unsigned char *rgba=&mine[mine.size()-4*npix];
+			for (int y=0;y<tiles.th;y++)
+				memcpy(&rgba[4*y*tiles.tw],&rendered[4*((y+a)*aw+a)],4*tiles.tw);
+			
+			// The last pass's samples, plus the coarsest level, which samples everything
+			int sampled=0;
+			for (int i=0;i<aw*ah;i++) sampled+=(rendered[4*i+3]>=128);
+			int l=multigrid_renderer::levels-1;
+			counts[t]=sampled+(aw>>l)*(ah>>l);
+		}
+		glFastUniform1f(prog,"multigridCountSamples",0.0f);
+		double elapsed=(clock()-start)*(1.0/CLOCKS_PER_SEC);
+
+		// Everybody gets every tile's count (each has exactly one nonzero contribution,
+		//   so the sums come out bit-identical everywhere, and so do the assignments)
+		MPI_Allreduce(&counts[0],&tiles.cost[0],n,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
+		MPI_Gather(&elapsed,1,MPI_DOUBLE,&busy[0],1,MPI_DOUBLE,0,MPI_COMM_WORLD);
+
+		// Gather the tiles to rank 0
+		std::vector<int> sizes(size,0), offsets(size,0);
+		for (int t=0;t<n;t++) sizes[tiles.owner[t]]+=4*npix;
+		for (int r=1;r<size;r++) offsets[r]=offsets[r-1]+sizes[r-1];
+		std::vector<unsigned char> all(rank==0?4*npix*n:1);
+		MPI_Gatherv(mine.size()?&mine[0]:NULL,mine.size(),MPI_UNSIGNED_CHAR,
+			&all[0],&sizes[0],&offsets[0],MPI_UNSIGNED_CHAR,0,MPI_COMM_WORLD);
+		if (rank==0) composite(all,offsets);
+	}
+
+private:
+	multigrid_renderer *renderer; // tile sized
+	oglFramebuffer *tile; // finished tile
+
+	static int mpi_size(void) { int s; MPI_Comm_size(MPI_COMM_WORLD,&s); return s; }
+
+	/* Draw the gathered tiles onscreen: each rank's come in tile order */
+	void composite(const std::vector<unsigned char> &all,std::vector<int> next) {
+		GLhandleARB old_prog=glGetHandleARB(GL_PROGRAM_OBJECT_ARB);
+		glUseProgramObjectARB(0);
+		glPushAttrib(GL_ENABLE_BIT);
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_BLEND);
+		for (int t=0;t<tiles.count();t++) {
+			int &at=next[tiles.owner[t]];
+			glWindowPos2i(tiles.x0(t),tiles.y0(t));
+			glDrawPixels(tiles.tw,tiles.th,GL_RGBA,GL_UNSIGNED_BYTE,&all[at]);
+			at+=4*tiles.tw*tiles.th;
+		}
+		glPopAttrib();
+		glUseProgramObjectARB(old_prog);
+	}
+};
+#endif
+
+#endif
@@ -52,7 +52,11 @@ oglFramebuffer::oglFramebuffer(int wid,int ht,GLenum texFormat,GLenum depthForma
 		glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, depth);
 	}
 	
-	if (fb==0 || stencilFormat==0) { stencil=0; }
+	if (depth && depthFormat==GL_DEPTH24_STENCIL8_EXT) { /* packed: one renderbuffer is both */
+		stencil=depth;
+		glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_STENCIL_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, stencil);
+	}
+	else if (fb==0 || stencilFormat==0) { stencil=0; }
 	else {
 		stencil=make_rb(stencilFormat);
 		glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_STENCIL_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, stencil);
@@ -63,7 +67,7 @@ oglFramebuffer::~oglFramebuffer() {
 	if (fb) glDeleteFramebuffersEXT(1,&fb);
 	if (tex) glDeleteTextures(1,&tex);
 	if (depth) glDeleteRenderbuffersEXT(1,&depth);
-	if (stencil) glDeleteRenderbuffersEXT(1,&stencil);
+	if (stencil && stencil!=depth) glDeleteRenderbuffersEXT(1,&stencil);
 }
 
 static void bad_framebuffer(GLenum status) {
@@ -28,7 +28,7 @@ public:
 	*/
 	oglFramebuffer(int wid,int ht,
 		GLenum colorFormat=GL_RGBA8,
-		GLenum depthFormat=0, /* e.g., GL_DEPTH_COMPONENT24 */
+		GLenum depthFormat=0, /* e.g., GL_DEPTH_COMPONENT24, or GL_DEPTH24_STENCIL8_EXT for depth and stencil */
 		GLenum stencilFormat=0); /* e.g., GL_STENCIL_INDEX */
 	~oglFramebuffer();
 	
@@ -0,0 +1,227 @@
+/**
+  Headless offscreen rendering, for benchmarking on machines with no
+  display, like batch nodes with only Mesa's software rasterizer.
+
+  Include this right after GL/glut.h.  Run the program with
+      -headless <frames> [<w>x<h>]
+  and glutInit, glutCreateWindow, and glutMainLoop make an EGL pbuffer
+  (on Mesa's surfaceless platform, if available) instead of a window,
+  call the display function that many times, print the time per frame,
+  write the last frame to headless.ppm (or oglHeadless.save, if the
+  program changes it; NULL skips it), and exit.  With 0 frames, we
+  keep drawing until the program exits (e.g., from its own -bench).
+  Swaps are skipped, so timings don't include vsync.  Without -headless,
+  every call goes straight to GLUT.
+  (Public Domain)
+*/
+#ifndef __OGL_HEADLESS_H
+#define __OGL_HEADLESS_H
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <fstream>
+#include <sys/time.h>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+/* Everything we know about our headless run */
+static struct oglHeadless_t {
+	bool on; // true if we were asked to run headless
+	int frames; // display calls before we exit (0: until the program exits)
+	int w,h; // pbuffer size
+	bool size_set; // w and h came from the command line
+	double start; // time of glutInit, in seconds
+	void (*display)(void);
+	void (*reshape)(int w,int h);
+	const char *save; // file for the last frame, or NULL to skip it
+} oglHeadless={false,0,640,480,false,0.0,NULL,NULL,"headless.ppm"};
+
+inline double oglHeadlessTime(void) {
+	struct timeval tv; gettimeofday(&tv,NULL);
+	return tv.tv_sec+1.0e-6*tv.tv_usec;
+}
+
+inline void oglHeadlessFail(const char *what) {
+	printf("Headless: %s failed (EGL error 0x%x)\n",what,eglGetError());
+	exit(1);
+}
+
+/* Make an EGL pbuffer and OpenGL context, and make them current */
+inline void oglHeadlessContext(void) {
+	EGLDisplay dpy=EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay=
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay)
+		dpy=getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,EGL_DEFAULT_DISPLAY,NULL);
+	if (dpy==EGL_NO_DISPLAY) dpy=eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	EGLint major=0, minor=0;
+	if (!eglInitialize(dpy,&major,&minor)) oglHeadlessFail("eglInitialize");
+
+	const EGLint config_attribs[]={
+		EGL_SURFACE_TYPE,EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE,EGL_OPENGL_BIT,
+		EGL_RED_SIZE,8, EGL_GREEN_SIZE,8, EGL_BLUE_SIZE,8, EGL_ALPHA_SIZE,8,
+		EGL_DEPTH_SIZE,24, EGL_NONE};
+	EGLConfig config; EGLint nconfig=0;
+	if (!eglChooseConfig(dpy,config_attribs,&config,1,&nconfig) || nconfig<1)
+		oglHeadlessFail("eglChooseConfig");
+	const EGLint pbuffer_attribs[]={EGL_WIDTH,oglHeadless.w, EGL_HEIGHT,oglHeadless.h, EGL_NONE};
+	EGLSurface surface=eglCreatePbufferSurface(dpy,config,pbuffer_attribs);
+	if (surface==EGL_NO_SURFACE) oglHeadlessFail("eglCreatePbufferSurface");
+	if (!eglBindAPI(EGL_OPENGL_API)) oglHeadlessFail("eglBindAPI");
+	EGLContext ctx=eglCreateContext(dpy,config,EGL_NO_CONTEXT,NULL);
+	if (ctx==EGL_NO_CONTEXT) oglHeadlessFail("eglCreateContext");
+	if (!eglMakeCurrent(dpy,surface,surface,ctx)) oglHeadlessFail("eglMakeCurrent");
+	printf("Headless: %dx%d pbuffer, EGL %d.%d, %s\n",oglHeadless.w,oglHeadless.h,
+		major,minor,(const char *)glGetString(GL_RENDERER));
+}
+
+/* Write the pbuffer to this PPM file, top row first */
+inline void oglHeadlessSave(const char *name) {
+	int w=oglHeadless.w, h=oglHeadless.h;
+	std::vector<unsigned char> data(w*h*3);
+	glPixelStorei(GL_PACK_ALIGNMENT,1);
+	glReadPixels(0,0,w,h,GL_RGB,GL_UNSIGNED_BYTE,&data[0]);
+	std::ofstream of(name,std::ios_base::binary);
+	of<<"P6\n"<<w<<" "<<h<<"\n255\n";
+	for (int y=h-1;y>=0;y--) of.write((char *)&data[y*w*3],w*3);
+}
+
+
+/* Stand-ins for GLUT.  Each calls the real GLUT routine unless we're headless. */
+inline void oglHeadlessInit(int *argc,char **argv) {
+	for (int argi=1;argi<*argc;argi++)
+	if (0==strcmp(argv[argi],"-headless") && argi+1<*argc) {
+		oglHeadless.on=true;
+		oglHeadless.frames=atoi(argv[argi+1]);
+		int used=2; // hide our arguments from the program
+		if (argi+2<*argc && 2==sscanf(argv[argi+2],"%dx%d",&oglHeadless.w,&oglHeadless.h)) {
+			oglHeadless.size_set=true;
+			used=3;
+		}
+		for (int i=argi;i+used<=*argc;i++) argv[i]=argv[i+used];
+		*argc-=used;
+		break;
+	}
+	oglHeadless.start=oglHeadlessTime();
+	if (!oglHeadless.on) (glutInit)(argc,argv);
+}
+inline void oglHeadlessInitDisplayMode(unsigned int mode) {
+	if (!oglHeadless.on) (glutInitDisplayMode)(mode);
+}
+inline void oglHeadlessInitWindowSize(int w,int h) {
+	if (!oglHeadless.size_set) { oglHeadless.w=w; oglHeadless.h=h; }
+	if (!oglHeadless.on) (glutInitWindowSize)(w,h);
+}
+inline int oglHeadlessCreateWindow(const char *title) {
+	if (!oglHeadless.on) return (glutCreateWindow)(title);
+	oglHeadlessContext();
+	return 1;
+}
+inline void oglHeadlessDisplayFunc(void (*f)(void)) {
+	oglHeadless.display=f;
+	if (!oglHeadless.on) (glutDisplayFunc)(f);
+}
+inline void oglHeadlessReshapeFunc(void (*f)(int,int)) {
+	oglHeadless.reshape=f;
+	if (!oglHeadless.on) (glutReshapeFunc)(f);
+}
+inline void oglHeadlessMouseFunc(void (*f)(int,int,int,int)) {
+	if (!oglHeadless.on) (glutMouseFunc)(f);
+}
+inline void oglHeadlessMotionFunc(void (*f)(int,int)) {
+	if (!oglHeadless.on) (glutMotionFunc)(f);
+}
+inline void oglHeadlessPassiveMotionFunc(void (*f)(int,int)) {
+	if (!oglHeadless.on) (glutPassiveMotionFunc)(f);
+}
+inline void oglHeadlessKeyboardFunc(void (*f)(unsigned char,int,int)) {
+	if (!oglHeadless.on) (glutKeyboardFunc)(f);
+}
+inline void oglHeadlessKeyboardUpFunc(void (*f)(unsigned char,int,int)) {
+	if (!oglHeadless.on) (glutKeyboardUpFunc)(f);
+}
+inline void oglHeadlessSetKeyRepeat(int repeat) {
+	if (!oglHeadless.on) (glutSetKeyRepeat)(repeat);
+}
+inline void oglHeadlessSetWindowTitle(const char *title) {
+	if (!oglHeadless.on) (glutSetWindowTitle)(title);
+}
+inline void oglHeadlessTimerFunc(unsigned int msecs,void (*f)(int),int value) {
+	if (!oglHeadless.on) (glutTimerFunc)(msecs,f,value); // headless frames just run back to back
+}
+inline void oglHeadlessPostRedisplay(void) {
+	if (!oglHeadless.on) (glutPostRedisplay)();
+}
+inline void oglHeadlessSwapBuffers(void) {
+	if (!oglHeadless.on) (glutSwapBuffers)();
+}
+inline int oglHeadlessGet(GLenum what) {
+	if (!oglHeadless.on) return (glutGet)(what);
+	switch (what) {
+	case GLUT_ELAPSED_TIME: return (int)(1000.0*(oglHeadlessTime()-oglHeadless.start));
+	case GLUT_WINDOW_WIDTH: case GLUT_SCREEN_WIDTH: return oglHeadless.w;
+	case GLUT_WINDOW_HEIGHT: case GLUT_SCREEN_HEIGHT: return oglHeadless.h;
+	default: return 0;
+	}
+}
+inline void oglHeadlessBitmapCharacter(void *font,int c) {
+	if (!oglHeadless.on) (glutBitmapCharacter)(font,c); // no fonts without GLUT
+}
+inline void oglHeadlessSolidSphere(double radius,GLint slices,GLint stacks) {
+	if (!oglHeadless.on) { (glutSolidSphere)(radius,slices,stacks); return; }
+	static GLUquadric *sphere=gluNewQuadric(); // GLUT's shapes need glutInit
+	gluSphere(sphere,radius,slices,stacks);
+}
+
+/* Draw our frames, report, and exit */
+inline void oglHeadlessMainLoop(void) {
+	if (!oglHeadless.on) { (glutMainLoop)(); return; }
+	if (oglHeadless.reshape) oglHeadless.reshape(oglHeadless.w,oglHeadless.h);
+	double first=0.0, total=0.0, best=1.0e30;
+	for (int frame=0;oglHeadless.frames<=0 || frame<oglHeadless.frames;frame++) {
+		double start=oglHeadlessTime();
+		if (oglHeadless.display) oglHeadless.display();
+		glFinish();
+		double elapsed=oglHeadlessTime()-start;
+		if (frame==0) first=elapsed; // includes shader compiles, loading, etc.
+		else { total+=elapsed; if (elapsed<best) best=elapsed; }
+	}
+	printf("Headless: %d frames at %dx%d: first %.2f ms",
+		oglHeadless.frames,oglHeadless.w,oglHeadless.h,first*1.0e3);
+	if (oglHeadless.frames>1)
+		printf(", then %.3f ms/frame (best %.3f ms, %.2f ns/pixel)",
+			total*1.0e3/(oglHeadless.frames-1),best*1.0e3,
+			best*1.0e9/(oglHeadless.w*(double)oglHeadless.h));
+	printf("\n");
+	if (oglHeadless.save) oglHeadlessSave(oglHeadless.save);
+	exit(0);
+}
+
+#define glutInit(argc,argv) oglHeadlessInit(argc,argv)
+#define glutInitDisplayMode(mode) oglHeadlessInitDisplayMode(mode)
+#define glutInitWindowSize(w,h) oglHeadlessInitWindowSize(w,h)
+#define glutCreateWindow(title) oglHeadlessCreateWindow(title)
+#define glutDisplayFunc(f) oglHeadlessDisplayFunc(f)
+#define glutReshapeFunc(f) oglHeadlessReshapeFunc(f)
+#define glutMouseFunc(f) oglHeadlessMouseFunc(f)
+#define glutMotionFunc(f) oglHeadlessMotionFunc(f)
+#define glutPassiveMotionFunc(f) oglHeadlessPassiveMotionFunc(f)
+#define glutKeyboardFunc(f) oglHeadlessKeyboardFunc(f)
+#define glutKeyboardUpFunc(f) oglHeadlessKeyboardUpFunc(f)
+#define glutSetKeyRepeat(repeat) oglHeadlessSetKeyRepeat(repeat)
+#define glutSetWindowTitle(title) oglHeadlessSetWindowTitle(title)
+#define glutTimerFunc(msecs,f,value) oglHeadlessTimerFunc(msecs,f,value)
+#define glutPostRedisplay() oglHeadlessPostRedisplay()
+#define glutSwapBuffers() oglHeadlessSwapBuffers()
+#define glutGet(what) oglHeadlessGet(what)
+#define glutBitmapCharacter(font,c) oglHeadlessBitmapCharacter(font,c)
+#define glutSolidSphere(radius,slices,stacks) oglHeadlessSolidSphere(radius,slices,stacks)
+#define glutMainLoop() oglHeadlessMainLoop()
+
+#endif
@@ -0,0 +1,303 @@
+/**
+  2D Delaunay triangulation and Voronoi diagram: implementation
+  of the interface in osl/delaunay.h.
+
+  The points' convex hull is fanned into triangles and flipped until
+  Delaunay, then the other points are inserted one at a time (in a
+  snake-ordered grid, so each insertion starts its walk near the last
+  one), and Lawson edge flips keep it Delaunay.  Points on an existing
+  edge split that edge, and repeated points are merged into one vertex.
+  Every triangle is made of input points, so the triangles exactly
+  cover the convex hull.
+
+  The Voronoi diagram is read off the finished triangulation: one
+  vertex per triangle circumcenter, one edge per Delaunay edge.
+  (Public Domain)
+*/
+#include "osl/delaunay.h"
+#include <math.h>
+#include <algorithm>
+
+namespace delaunay {
+
+void Consumer::voronoi_line(delaunay::Edge *v) {}
+void Consumer::voronoi_edge(delaunay::Edge *v) {}
+void Consumer::voronoi_vertex(delaunay::Site *s) {}
+void Consumer::delaunay_vertex(delaunay::Site *s) {}
+void Consumer::delaunay_triangle(int v1,int v2,int v3) {}
+Consumer::~Consumer() {}
+
+/* Twice the signed area of triangle abc: positive if counterclockwise */
+static inline float_t orient(const Point &a,const Point &b,const Point &c) {
+	return (b.x-a.x)*(c.y-a.y)-(b.y-a.y)*(c.x-a.x);
+}
+
+/* Positive if d is inside the circumcircle of counterclockwise triangle abc */
+static inline float_t incircle(const Point &a,const Point &b,const Point &c,const Point &d) {
+	float_t ax=a.x-d.x, ay=a.y-d.y, bx=b.x-d.x, by=b.y-d.y, cx=c.x-d.x, cy=c.y-d.y;
+	return (ax*ax+ay*ay)*(bx*cy-by*cx)
+	      -(bx*bx+by*by)*(ax*cy-ay*cx)
+	      +(cx*cx+cy*cy)*(ax*by-ay*bx);
+}
+
+/* A counterclockwise triangle.  n[i] is the triangle across the edge
+   opposite v[i], or -1 on the hull. */
+struct Tri {
+	int v[3];
+	int n[3];
+};
+
+class Triangulation {
+public:
+	std::vector<Point> pts; // vertex coordinates
+	std::vector<Tri> tris;
+
+	/* Start with this convex polygon (counterclockwise, no three points
+	   in a line), fanned out from its first point, then flipped until Delaunay */
+	Triangulation(const std::vector<Point> &hull) :pts(hull) {
+		int h=hull.size();
+		for (int i=1;i+1<h;i++) // triangle i-1 is (0,i,i+1)
+			make(0,i,i+1, -1,i+2<h?i:-1,i>=2?i-2:-1);
+		for (bool flipped=true;flipped;) { // any flip can spoil its neighbors, so repeat
+			flipped=false;
+			for (unsigned int t=0;t<tris.size();t++)
+			for (int i=0;i<3;i++) {
+				legalize(t);
+				if (!flips.empty()) { flipped=true; flips.clear(); }
+				rotate(t); // check the next edge
+			}
+		}
+		last=0;
+	}
+
+	/* Insert p.  Returns its vertex number, or the existing vertex at p. */
+	int insert(const Point &p) {
+		int t=locate(p);
+		float_t o[3];
+		int zeros=0, edge=-1;
+		for (int i=0;i<3;i++) {
+			o[i]=orient(pts[tris[t].v[(i+1)%3]],pts[tris[t].v[(i+2)%3]],p);
+			if (o[i]==0) { zeros++; edge=i; }
+		}
+		if (zeros>=2) { // p is one of this triangle's vertices
+			for (int i=0;i<3;i++) if (o[i]!=0) return tris[t].v[i];
+		}
+		int v=pts.size();
+		pts.push_back(p);
+		if (zeros==1) split_edge(t,edge,v);
+		else split_triangle(t,v);
+		while (!flips.empty()) {
+			int f=flips.back(); flips.pop_back();
+			legalize(f);
+		}
+		return v;
+	}
+
+private:
+	int last; // triangle we last inserted into: start walking here
+	std::vector<int> flips; // triangles whose edge 0 (opposite the new point) may need a flip
+
+	int make(int a,int b,int c,int na,int nb,int nc) {
+		Tri t={{a,b,c},{na,nb,nc}};
+		tris.push_back(t);
+		return tris.size()-1;
+	}
+	void set(int t,int a,int b,int c,int na,int nb,int nc) {
+		Tri n={{a,b,c},{na,nb,nc}};
+		tris[t]=n;
+	}
+	/* Renumber triangle t's vertices (and neighbors) one place down */
+	void rotate(int t) {
+		Tri o=tris[t];
+		set(t, o.v[1],o.v[2],o.v[0], o.n[1],o.n[2],o.n[0]);
+	}
+	/* Make triangle t's neighbor across the edge it used to share with from point to to */
+	void repoint(int t,int from,int to) {
+		if (t<0) return;
+		for (int i=0;i<3;i++) if (tris[t].n[i]==from) { tris[t].n[i]=to; return; }
+	}
+
+	/* Walk from the last triangle to the one containing p */
+	int locate(const Point &p) {
+		int t=last, start=0;
+		for (;;) {
+			int next=-1;
+			for (int k=0;k<3;k++) {
+				int i=(start+k)%3; // rotate the first edge checked, so we can't cycle
+				if (orient(pts[tris[t].v[(i+1)%3]],pts[tris[t].v[(i+2)%3]],p)<0) {
+					next=tris[t].n[i];
+					break;
+				}
+			}
+			if (next<0) return last=t; // inside t
+			t=next;
+			start=(start+1)%3;
+		}
+	}
+
+	/* New vertex v is inside triangle t: split it into three */
+	void split_triangle(int t,int v) {
+		Tri o=tris[t];
+		int a=o.v[0], b=o.v[1], c=o.v[2];
+		int t1=tris.size(), t2=t1+1;
+		set(t, v,b,c, o.n[0],t1,t2);
+		make(v,c,a, o.n[1],t2,t);
+		make(v,a,b, o.n[2],t,t1);
+		repoint(o.n[1],t,t1);
+		repoint(o.n[2],t,t2);
+		flips.push_back(t); flips.push_back(t1); flips.push_back(t2);
+	}
+
+	/* New vertex v is on the edge of triangle t opposite vertex i: split
+	   t and its neighbor across that edge into two triangles each */
+	void split_edge(int t,int i,int v) {
+		Tri o=tris[t];
+		int a=o.v[i], b=o.v[(i+1)%3], c=o.v[(i+2)%3];
+		int nb=o.n[(i+1)%3], nc=o.n[(i+2)%3]; // across edges ca and ab
+		int u=o.n[i];
+		int B=tris.size();
+		int D2=(u>=0)?B+1:-1;
+		set(t, v,a,b, nc,D2,B);
+		make(v,c,a, nb,t,u);
+		repoint(nb,t,B);
+		flips.push_back(t); flips.push_back(B);
+		if (u>=0) { // u is (d,c,b), rotated
+			Tri uo=tris[u];
+			int j=0;
+			while (uo.n[j]!=t) j++;
+			int d=uo.v[j];
+			int ud_c=uo.n[(j+1)%3], ud_b=uo.n[(j+2)%3]; // across edges bd and dc
+			set(u, v,d,c, ud_b,B,D2);
+			make(v,b,d, ud_c,u,t);
+			repoint(ud_c,u,D2);
+			flips.push_back(u); flips.push_back(D2);
+		}
+	}
+
+	/* Flip triangle t's edge 0 if the point across it is in t's circumcircle */
+	void legalize(int t) {
+		Tri T=tris[t];
+		int o=T.n[0];
+		if (o<0) return;
+		Tri O=tris[o];
+		int k=0;
+		while (O.n[k]!=t) k++;
+		int p=T.v[0], b=T.v[1], c=T.v[2], q=O.v[k];
+		if (incircle(pts[p],pts[b],pts[c],pts[q])<=0) return;
+		int X=O.n[(k+1)%3], Y=O.n[(k+2)%3]; // across edges bq and qc
+		int V=T.n[1], W=T.n[2]; // across edges cp and pb
+		set(t, p,b,q, X,o,W);
+		set(o, p,q,c, Y,V,t);
+		repoint(X,o,t);
+		repoint(V,t,o);
+		flips.push_back(t); flips.push_back(o);
+	}
+};
+
+/* Indices of the convex hull of pts, counterclockwise, leaving out
+   points along its edges (Andrew's monotone chain) */
+static std::vector<int> convex_hull(const std::vector<Point> &pts) {
+	int n=pts.size();
+	std::vector<std::pair<std::pair<float_t,float_t>,int> > sorted(n); // by x, then y
+	for (int i=0;i<n;i++) sorted[i]=std::make_pair(std::make_pair(pts[i].x,pts[i].y),i);
+	std::sort(sorted.begin(),sorted.end());
+	std::vector<int> h(2*n);
+	int k=0;
+	for (int i=0;i<n;i++) { // lower hull, left to right
+		int p=sorted[i].second;
+		while (k>=2 && orient(pts[h[k-2]],pts[h[k-1]],pts[p])<=0) k--;
+		h[k++]=p;
+	}
+	for (int i=n-2,lower=k+1;i>=0;i--) { // upper hull, right to left
+		int p=sorted[i].second;
+		while (k>=lower && orient(pts[h[k-2]],pts[h[k-1]],pts[p])<=0) k--;
+		h[k++]=p;
+	}
+	h.resize(std::max(k-1,0)); // the last point repeats the first
+	return h;
+}
+
+/* Circumcenter of triangle abc */
+static Point circumcenter(const Point &a,const Point &b,const Point &c) {
+	float_t bx=b.x-a.x, by=b.y-a.y, cx=c.x-a.x, cy=c.y-a.y;
+	float_t d=2*(bx*cy-by*cx);
+	float_t b2=bx*bx+by*by, c2=cx*cx+cy*cy;
+	return Point(a.x+(cy*b2-by*c2)/d, a.y+(bx*c2-cx*b2)/d);
+}
+
+void compute(const std::vector<Point> &pts,Consumer &dest) {
+	int n=pts.size();
+	std::vector<Site> sites(n);
+	for (int i=0;i<n;i++) {
+		sites[i].coord=pts[i]; sites[i].sitenbr=i; sites[i].refcnt=1;
+		dest.delaunay_vertex(&sites[i]);
+	}
+	if (n<3) return;
+	std::vector<int> hull=convex_hull(pts);
+	if (hull.size()<3) return; // all on a line: no triangles
+
+	Point lo=pts[0], hi=pts[0];
+	for (int i=1;i<n;i++) {
+		lo.x=std::min(lo.x,pts[i].x); lo.y=std::min(lo.y,pts[i].y);
+		hi.x=std::max(hi.x,pts[i].x); hi.y=std::max(hi.y,pts[i].y);
+	}
+
+	// Insertion order: rows of grid cells, alternating direction
+	int cells=(int)ceil(sqrt(n/4.0));
+	std::vector<std::pair<int,int> > order(n); // (cell number, point)
+	for (int i=0;i<n;i++) {
+		int cx=std::min(cells-1,(int)(cells*(pts[i].x-lo.x)/(hi.x-lo.x)));
+		int cy=std::min(cells-1,(int)(cells*(pts[i].y-lo.y)/(hi.y-lo.y)));
+		if (cy&1) cx=cells-1-cx;
+		order[i]=std::make_pair(cx+cy*cells,i);
+	}
+	std::sort(order.begin(),order.end());
+
+	std::vector<Point> outline(hull.size());
+	for (unsigned int i=0;i<hull.size();i++) outline[i]=pts[hull[i]];
+	Triangulation tri(outline);
+	std::vector<int> input(hull); // vertex number -> input point number
+	input.reserve(n);
+	for (int i=0;i<n;i++) {
+		int p=order[i].second;
+		int v=tri.insert(pts[p]);
+		if (v==(int)input.size()) input.push_back(p);
+	}
+
+	// One voronoi vertex per triangle
+	int ntri=tri.tris.size();
+	std::vector<Site> vertices(ntri);
+	for (int t=0;t<ntri;t++) {
+		const Tri &T=tri.tris[t];
+		int a=input[T.v[0]], b=input[T.v[1]], c=input[T.v[2]];
+		dest.delaunay_triangle(a,b,c);
+		vertices[t].coord=circumcenter(pts[a],pts[b],pts[c]);
+		vertices[t].sitenbr=t; vertices[t].refcnt=1;
+	}
+	for (int t=0;t<ntri;t++) dest.voronoi_vertex(&vertices[t]);
+
+	// One voronoi edge per delaunay edge, between the circumcenters on either side
+	int nedge=0;
+	for (int t=0;t<ntri;t++) {
+		const Tri &T=tri.tris[t];
+		for (int i=0;i<3;i++) {
+			int o=T.n[i];
+			bool other=(o>=0);
+			if (other && o<t) continue; // the other triangle does this edge
+			Site *r0=&sites[input[T.v[(i+1)%3]]], *r1=&sites[input[T.v[(i+2)%3]]];
+			Edge e;
+			float_t dx=r1->coord.x-r0->coord.x, dy=r1->coord.y-r0->coord.y;
+			e.c=dx*(r0->coord.x+dx*0.5)+dy*(r0->coord.y+dy*0.5); // perpendicular bisector
+			if (fabs(dx)>fabs(dy)) { e.a=1.0; e.b=dy/dx; e.c/=dx; }
+			else { e.b=1.0; e.a=dx/dy; e.c/=dy; }
+			e.reg[0]=r0; e.reg[1]=r1;
+			e.ep[0]=&vertices[t];
+			e.ep[1]=other?&vertices[o]:0;
+			e.edgenbr=nedge++;
+			dest.voronoi_line(&e);
+			dest.voronoi_edge(&e);
+		}
+	}
+}
+
+};
@@ -45,6 +45,7 @@ class porlock
 {
 protected:
 	CRITICAL_SECTION critsec;
+	friend class porcond;
 public:
 	inline porlock()	{ InitializeCriticalSection(&critsec); }
 	inline ~porlock()	{ DeleteCriticalSection(&critsec); }
@@ -52,6 +53,17 @@ public:
 	inline void unlock()	{ LeaveCriticalSection(&critsec); }
 };
 
+class porcond
+{
+protected:
+	CONDITION_VARIABLE cond;
+public:
+	inline porcond()	{ InitializeConditionVariable(&cond); }
+	inline void wait(porlock &l)	{ SleepConditionVariableCS(&cond, &l.critsec, INFINITE); }
+	inline void signal()	{ WakeConditionVariable(&cond); }
+	inline void broadcast()	{ WakeAllConditionVariable(&cond); }
+};
+
 
 #else /* Portable UNIX pthread version */
 #include <pthread.h>
@@ -60,6 +72,7 @@ class porlock
 {
 protected:
 	pthread_mutex_t mtx;
+	friend class porcond;
 public:
 	inline porlock()	{ pthread_mutex_init(&mtx, 0); }
 	inline ~porlock()	{ pthread_mutex_destroy(&mtx); }
@@ -67,8 +80,27 @@ public:
 	inline void unlock()	{ pthread_mutex_unlock(&mtx); }
 };
 
+class porcond
+{
+protected:
+	pthread_cond_t cond;
+public:
+	inline porcond()	{ pthread_cond_init(&cond, 0); }
+	inline ~porcond()	{ pthread_cond_destroy(&cond); }
+	inline void wait(porlock &l)	{ pthread_cond_wait(&cond, &l.mtx); }
+	inline void signal()	{ pthread_cond_signal(&cond); }
+	inline void broadcast()	{ pthread_cond_broadcast(&cond); }
+};
+
 #endif
 
+/**
+  porcond is a condition variable: wait() must be called with the
+  porlock locked, and unlocks it until another thread calls signal()
+  (wake one waiter) or broadcast() (wake them all).  Wakeups can be
+  spurious, so wait in a loop that rechecks what you're waiting for.
+*/
+
 /**
   C++ "scoped" lock.  Locks the lock on creation,
   unlocks the lock on deletion, which is guaranteed